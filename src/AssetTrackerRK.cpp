@@ -89,8 +89,19 @@ bool AssetTrackerLIS3DH::calibrateFilter(unsigned long stationaryTime, unsigned
 //
 //
 //
-AssetTrackerBase::AssetTrackerBase() : LegacyAdapter(gps) {
+AssetTrackerBase::AssetTrackerBase() : LegacyAdapter(gps), nmeaParser(true), serialBaud(GPS_BAUD) {
 	instance = this;
+
+	gps.setPublishCallback([this](TinyGPSSentenceType sentenceType) {
+		callFixCallbacks(sentenceType);
+	});
+
+	demux.withNmeaDecoder([this](const uint8_t *buf, size_t len) {
+		return decodeNmea(buf, len);
+	});
+	demux.withUbxDecoder([this](const uint8_t *buf, size_t len) {
+		externalBlockDecoder(buf, len);
+	});
 }
 
 AssetTrackerBase::~AssetTrackerBase() {
@@ -105,7 +116,8 @@ void AssetTrackerBase::begin() {
 		os_mutex_create(&mutex);
 	}
 	if (!useWire) {
-		serialPort.begin(GPS_BAUD);
+		serialPort.begin(serialBaud);
+		serialStarted = true;
 	}
 	if (extIntPin != PIN_INVALID) {
 		pinMode(extIntPin, OUTPUT);
@@ -116,45 +128,134 @@ void AssetTrackerBase::begin() {
 
 void AssetTrackerBase::updateGPS(void) {
 	bool hasSentence = false;
+	size_t waiting = 0;
+	size_t count = 0;
 
 	if (!useWire) {
-		while (serialPort.available() > 0) {
-			char c = (char)serialPort.read();
-			hasSentence |= gps.encode(c);
-			if (externalDecoder) {
-				externalDecoder(c);
+		uint8_t buf[SERIAL_CHUNK_SIZE];
+
+		// The port is read under the same lock setSerialBaud() holds while it reopens the port,
+		// but the data is decoded with it released so handlers can send commands
+		while(true) {
+			size_t readLen = 0;
+
+			WITH_LOCK(*this) {
+				int available = serialPort.available();
+				if (available > 0) {
+					if (waiting == 0) {
+						waiting = (size_t)available;
+					}
+					size_t reqLen = (size_t)available;
+					if (reqLen > sizeof(buf)) {
+						reqLen = sizeof(buf);
+					}
+					// Never asks for more than is available, so this does not wait for the stream timeout
+					readLen = serialPort.readBytes((char *)buf, reqLen);
+				}
+			}
+			if (readLen == 0) {
+				break;
 			}
+			count += readLen;
+			hasSentence |= decodeBlock(buf, readLen);
 		}
 	}
 	else {
-		uint8_t buf[32];
+		uint8_t buf[WIRE_BATCH_SIZE];
+		size_t remaining = 0;
+		bool first = true;
+
+		// The length in 0xFD and 0xFE is only read once per call, when the previous backlog has been
+		// drained. Reading it leaves the register address at 0xFF (the data stream), and it stays there
+		// for the chained requestFrom calls below. Writing a command to the GPS does not move it, as only
+		// a one byte write sets the register address. Only the bytes waiting at the start are drained
+		// so a busy GPS can't keep this from returning.
+		//
+		// The Wire lock is released to decode each batch of up to WIRE_BATCH_SIZE bytes, so the parser
+		// and publish callbacks don't hold up other I2C users.
+		while(true) {
+			size_t batchLen = 0;
+			bool readError = false;
 
-		WITH_LOCK(wire) {
-			uint16_t available = wireReadBytesAvailable();
-			if (available > 32) {
-				available = 32;
-			}
-			if (available > 0) {
-				if (wireReadBytes(buf, available) == available) {
-					for(uint16_t ii = 0; ii < available; ii++) {
-						hasSentence |= gps.encode(buf[ii]);
-						if (externalDecoder) {
-							externalDecoder(buf[ii]);
-						}
+			WITH_LOCK(wire) {
+				if (first) {
+					waiting = remaining = wireReadBytesAvailable();
+					first = false;
+				}
+
+				size_t batchTarget = remaining;
+				if (batchTarget > WIRE_BATCH_SIZE) {
+					batchTarget = WIRE_BATCH_SIZE;
+				}
+
+				while(batchLen < batchTarget && !readError) {
+					size_t reqLen = batchTarget - batchLen;
+					if (reqLen > WIRE_CHUNK_SIZE) {
+						reqLen = WIRE_CHUNK_SIZE;
+					}
+					if (wireReadBytes(&buf[batchLen], reqLen, batchLen + reqLen == batchTarget) != (int)reqLen) {
+						readError = true;
+					}
+					else {
+						batchLen += reqLen;
 					}
-					// Log.info("got %d bytes from GNSS", available);
-					// Log.dump(buf, available);
 				}
 			}
+
+			if (batchLen > 0) {
+				count += batchLen;
+				remaining -= batchLen;
+				hasSentence |= decodeBlock(buf, batchLen);
+			}
+			if (batchLen == 0 || readError || remaining == 0) {
+				break;
+			}
 		}
 	}
+	updateReadStats(waiting, count);
+
 	if (hasSentence) {
 		for(auto it = sentenceCallbacks.begin(); it != sentenceCallbacks.end(); it++) {
 			(*it)();
 		}
 	}
+	else {
+		// Publish a partial epoch if the GPS has stopped sending
+		gps.checkEpochTimeout();
+	}
+}
+
+bool AssetTrackerBase::decodeBlock(const uint8_t *buf, size_t len) {
+	if (externalBlockDecoder) {
+		return demux.decode(buf, len);
+	}
+
+	bool hasSentence = decodeNmea(buf, len);
+
+	if (externalDecoder) {
+		for(size_t ii = 0; ii < len; ii++) {
+			externalDecoder((char)buf[ii]);
+		}
+	}
+	return hasSentence;
 }
 
+bool AssetTrackerBase::decodeNmea(const uint8_t *buf, size_t len) {
+	return nmeaParser && (gps.encode((const char *)buf, len) > 0);
+}
+
+void AssetTrackerBase::callFixCallbacks(TinyGPSSentenceType sentenceType) {
+	if (fixCallbacks.empty()) {
+		return;
+	}
+
+	FixSnapshot snap;
+	gps.copyFixSnapshotTo(snap);
+
+	for(auto it = fixCallbacks.begin(); it != fixCallbacks.end(); it++) {
+		(*it)(snap, sentenceType);
+	}
+}
 
 void AssetTrackerBase::sendCommand(const uint8_t *cmd, size_t len) {
 
@@ -164,6 +265,8 @@ void AssetTrackerBase::sendCommand(const uint8_t *cmd, size_t len) {
 	Log.print("\r\n");
 	 */
 
+	lastCommandMs = millis();
+
 	WITH_LOCK(*this) {
 		if (!useWire) {
 			serialPort.write(cmd, len);
@@ -176,8 +279,8 @@ void AssetTrackerBase::sendCommand(const uint8_t *cmd, size_t len) {
 					// uint8_t res;
 
 					size_t reqLen = (len - offset);
-					if (reqLen > 32) {
-						reqLen = 32;
+					if (reqLen > WIRE_CHUNK_SIZE) {
+						reqLen = WIRE_CHUNK_SIZE;
 					}
 
 					wire.beginTransmission(wireAddr);
@@ -192,10 +295,21 @@ void AssetTrackerBase::sendCommand(const uint8_t *cmd, size_t len) {
 		}
 	}
 
+	// Wake the thread so the response is read promptly
+	wakeThread();
 }
 
 void AssetTrackerBase::startThreadedMode() {
 	if (thread == NULL) {
+		if (threadSleep) {
+			os_queue_create(&wakeQueue, sizeof(uint8_t), 1, 0);
+			if (dataReadyPin != PIN_INVALID) {
+				pinMode(dataReadyPin, INPUT);
+				attachInterrupt(dataReadyPin, [this]() {
+					wakeThread();
+				}, RISING);
+			}
+		}
 		thread = new Thread("AssetTracker", threadFunctionStatic, this, OS_THREAD_PRIORITY_DEFAULT, 2048);
 	}
 }
@@ -207,8 +321,111 @@ void AssetTrackerBase::threadFunction() {
 		for(auto it = threadCallbacks.begin(); it != threadCallbacks.end(); it++) {
 			(*it)();
 		}
-		os_thread_yield();
+		if (wakeQueue) {
+			uint8_t c;
+			os_queue_take(wakeQueue, &c, threadSleepTime(), 0);
+		}
+		else {
+			os_thread_yield();
+		}
+	}
+}
+
+void AssetTrackerBase::wakeThread() {
+	if (wakeQueue) {
+		uint8_t c = 0;
+		os_queue_put(wakeQueue, &c, 0, 0);
+	}
+}
+
+void AssetTrackerBase::updateReadStats(size_t waiting, size_t count) {
+	unsigned long now = millis();
+
+	stats.wakeups++;
+	statsSecondWakeups++;
+	if (now - statsSecondStart >= 1000) {
+		stats.wakeupsPerSecond = statsSecondWakeups;
+		statsSecondWakeups = 0;
+		statsSecondStart = now;
+	}
+
+	if (waiting > stats.bufferHighWater) {
+		stats.bufferHighWater = (waiting < 0xffff) ? (uint16_t)waiting : 0xffff;
+	}
+
+	if (count > 0) {
+		if (lastDataMs == 0 || now - lastDataMs >= BURST_GAP_MS) {
+			// First data after an idle gap is the start of a new burst
+			if (burstStartMs != 0) {
+				unsigned long period = now - burstStartMs;
+				// Smooth the period, but take a new rate (or a missed burst) right away
+				if (epochPeriodMs == 0 || period > epochPeriodMs + epochPeriodMs / 4 || period < epochPeriodMs - epochPeriodMs / 4) {
+					epochPeriodMs = period;
+				}
+				else {
+					epochPeriodMs = (epochPeriodMs * 3 + period) / 4;
+				}
+			}
+			burstStartMs = now;
+			if (burstBytes != 0) {
+				stats.epochBytes = burstBytes;
+				if (burstBytes > stats.epochBytesHighWater) {
+					stats.epochBytesHighWater = burstBytes;
+				}
+			}
+			burstBytes = 0;
+		}
+		burstBytes += count;
+		lastDataMs = now;
+	}
+}
+
+unsigned long AssetTrackerBase::threadSleepTime() const {
+	unsigned long sleepMs;
+
+	if (!useWire) {
+		// Time to fill half of the receive buffer at 10 bits per byte
+		sleepMs = (SERIAL_RX_BUFFER_SIZE / 2) * 10 * 1000 / serialBaud;
+	}
+	else {
+		sleepMs = I2C_MAX_SLEEP_MS;
+	}
+	if (sleepMs == 0) {
+		sleepMs = 1;
+	}
+
+	unsigned long now = millis();
+	if (epochPeriodMs == 0 || now - lastDataMs < BURST_GAP_MS) {
+		// Epoch timing not known yet, or in the middle of a burst
+		return sleepMs;
+	}
+	if (now - lastCommandMs < COMMAND_RESPONSE_MS) {
+		// A response could arrive at any time
+		return sleepMs;
+	}
+
+	// Between bursts, sleep until shortly before the next one is expected
+	unsigned long sinceBurst = now - burstStartMs;
+	if (sinceBurst + EPOCH_GUARD_MS < epochPeriodMs) {
+		unsigned long untilBurst = epochPeriodMs - EPOCH_GUARD_MS - sinceBurst;
+		if (untilBurst > sleepMs) {
+			sleepMs = untilBurst;
+		}
 	}
+	return sleepMs;
+}
+
+AssetTrackerThreadStats AssetTrackerBase::getThreadStats() const {
+	AssetTrackerThreadStats result = stats;
+	result.bufferSize = useWire ? 0 : SERIAL_RX_BUFFER_SIZE;
+	result.epochPeriod = epochPeriodMs;
+	return result;
+}
+
+void AssetTrackerBase::resetThreadStats() {
+	stats.wakeups = 0;
+	stats.bufferHighWater = 0;
+	stats.epochBytesHighWater = 0;
 }
 
 // [static]
@@ -229,6 +446,22 @@ void AssetTrackerBase::unlock() {
 };
 
 
+void AssetTrackerBase::setSerialBaud(uint32_t baud) {
+	WITH_LOCK(*this) {
+		bool reopen = (serialBaud != baud) && !useWire && serialStarted;
+
+		serialBaud = baud;
+
+		if (reopen) {
+			// updateGPS() reads the port under this lock, so it can't be in readBytes() here.
+			// Finish sending any command at the old rate first.
+			serialPort.flush();
+			serialPort.end();
+			serialPort.begin(serialBaud);
+		}
+	}
+}
+
 AssetTrackerBase &AssetTrackerBase::withSerialPort(USARTSerial &port) {
 	useWire = false;
 	serialPort = port;
@@ -269,37 +502,20 @@ uint16_t AssetTrackerBase::wireReadBytesAvailable() {
 	return available;
 }
 
-int AssetTrackerBase::wireReadBytes(uint8_t *buf, size_t len) {
-	uint8_t res;
-
+int AssetTrackerBase::wireReadBytes(uint8_t *buf, size_t len, bool stop) {
 	// Log.info("wireReadBytes len=%u", len);
 
-	wire.beginTransmission(wireAddr);
-	wire.write(0xff);
-	res = wire.endTransmission(false);
-	if (res != 0) {
-		// Log.info("wireReadBytes I2C error %u", res);
+	// This reads from the current register address, which is 0xFF (the data stream) after
+	// wireReadBytesAvailable(), and stays there.
+	size_t res = wire.requestFrom(wireAddr, (uint8_t) len, (uint8_t) stop);
+	if (res != len) {
+		// Log.info("wireReadBytes incorrect count %u", res);
 		return -1;
 	}
 
-	size_t offset = 0;
-
-	while(offset < len) {
-		size_t reqLen = (len - offset);
-		if (reqLen > 32) {
-			reqLen = 32;
-		}
-		res = wire.requestFrom(wireAddr, (uint8_t) reqLen, (uint8_t) ((offset + reqLen) == len));
-		if (res != reqLen) {
-			// Log.info("wireReadBytes incorrect count %u", res);
-			return -1;
-		}
-
-		for(size_t ii = 0; ii < reqLen; ii++) {
-			buf[offset + ii] = wire.read();
-		}
-		offset += reqLen;
- 	}
+	for(size_t ii = 0; ii < len; ii++) {
+		buf[ii] = wire.read();
+	}
 	return len;
 }
 
@@ -367,12 +583,12 @@ void AssetTrackerLED::setup(pin_t pin_, AssetTrackerBase *base_) {
 	pinMode(pin, OUTPUT);
 	digitalWrite(pin, LOW);
 
-	base->setSentenceCallback([this]() {
-		if (base->gpsFix()) {
+	base->setFixCallback([this](const FixSnapshot &snap, TinyGPSSentenceType sentenceType) {
+		if (snap.locationValid && snap.locationAge < LegacyAdapter::MAX_GPS_AGE_MS) {
 			blinkState = BlinkState::ON;
 		}
 		else {
-			if (base->getSatellites() > 3) {
+			if (snap.satellites > 3) {
 				blinkState = BlinkState::FAST;
 			}
 			else {
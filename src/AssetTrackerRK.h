@@ -73,6 +73,24 @@ protected:
 	LIS3DH *accel;
 };
 
+/**
+ * @brief Statistics about the GPS thread, returned by AssetTrackerBase::getThreadStats()
+ */
+struct AssetTrackerThreadStats {
+	uint32_t wakeups; 				//!< Number of times the GPS was read since the stats were reset
+	uint32_t wakeupsPerSecond; 		//!< Number of times the GPS was read in the last full second
+	uint16_t bufferHighWater; 		//!< Most bytes waiting to be read at once (serial buffer or DDC bytes available)
+	uint16_t bufferSize; 			//!< Size of the serial receive buffer, 0 for I2C
+	uint32_t epochPeriod; 			//!< Measured time between the starts of the GPS bursts in milliseconds, 0 if not known yet
+	uint32_t epochBytes; 			//!< Number of bytes in the last complete GPS burst
+	uint32_t epochBytesHighWater; 	//!< Most bytes in one GPS burst
+};
+
+/**
+ * @brief Byte counts from the NMEA/UBX demultiplexer, returned by AssetTrackerBase::getDemuxStats()
+ */
+typedef UbloxNmeaDemuxStats AssetTrackerDemuxStats;
+
 /**
  * @brief Base functionality for GNSS functionality using TinyGPS
  */
@@ -98,6 +116,54 @@ public:
 	 */
 	void startThreadedMode();
 
+	/**
+	 * @brief Returns true if startThreadedMode() has been called
+	 */
+	bool isThreadedMode() const { return thread != NULL; };
+
+	/**
+	 * @brief Make the GPS thread sleep until data is expected instead of reading the GPS constantly
+	 *
+	 * @param enable true to sleep between reads (default), false to read and yield in a loop
+	 *
+	 * The sleep time is limited so the serial receive buffer (at the current baud rate) cannot overflow.
+	 * Once the GPS bursts have been timed, the thread sleeps from the end of a burst until shortly before
+	 * the next one is expected, unless a command was sent recently. Sending a command or a rising edge on
+	 * the pin set with withDataReadyPin() wakes the thread immediately.
+	 *
+	 * The thread callbacks are called once per wakeup, so they are called less often in this mode.
+	 */
+	AssetTrackerBase &withThreadSleep(bool enable = true) { threadSleep = enable; return *this; };
+
+	/**
+	 * @brief Wake the GPS thread when this pin goes high
+	 *
+	 * @param pin The MCU pin connected to the u-blox TXD-ready output (configured with UBX-CFG-PRT)
+	 *
+	 * Only used with withThreadSleep(). Call before startThreadedMode().
+	 */
+	AssetTrackerBase &withDataReadyPin(pin_t pin) { dataReadyPin = pin; return *this; };
+
+	/**
+	 * @brief Wake the GPS thread if it's sleeping. Can be called from an ISR.
+	 */
+	void wakeThread();
+
+	/**
+	 * @brief Gets the number of bytes of each protocol and framing errors
+	 */
+	AssetTrackerDemuxStats getDemuxStats() const { return demux.getStats(); };
+
+	/**
+	 * @brief Gets statistics about reading the GPS, used to tune withThreadSleep()
+	 */
+	AssetTrackerThreadStats getThreadStats() const;
+
+	/**
+	 * @brief Clears the wakeup count and buffer high-water mark
+	 */
+	void resetThreadStats();
+
 
 	void enterSleep();
 
@@ -123,6 +189,17 @@ public:
 	 */
 	void setExternalDecoder(std::function<bool(char)> fn) { externalDecoder = fn; };
 
+	/**
+	 * @brief Sets the external decoder function that is passed a block of data at a time
+	 *
+	 * @param fn function set. Replaces any existing function. Set to 0 to remove.
+	 *
+	 * This is the same as setExternalDecoder() but fn is only passed UBX frames (starting with
+	 * 0xB5 0x62), a range at a time. NMEA sentences only go to TinyGPS++. If both are set, only
+	 * this one is called.
+	 */
+	void setExternalBlockDecoder(std::function<void(const uint8_t *buf, size_t len)> fn) { externalBlockDecoder = fn; };
+
 	/**
 	 * @brief Set a function to be called during the threaded mode loop
 	 */
@@ -133,6 +210,18 @@ public:
 	 */
 	void setSentenceCallback(std::function<void(void)> fn) { sentenceCallbacks.push_back(fn); };
 
+	/**
+	 * @brief Set a function to be called when new fix data is published
+	 *
+	 * The function is passed a snapshot of the data that was just published and the type of
+	 * the sentence that published it, so it does not need to call gpsFix(), getSatellites(), etc.
+	 * By default this is called after each RMC and GGA sentence. To merge the sentences with the
+	 * same time and be called once per epoch, use getTinyGPSPlus()->setEpochSentences().
+	 * The snapshot is made once and shared by all of the fix callbacks. The function is called
+	 * from updateGPS(), or the GPS thread in threaded mode, and should return quickly.
+	 */
+	void setFixCallback(std::function<void(const FixSnapshot &snap, TinyGPSSentenceType sentenceType)> fn) { fixCallbacks.push_back(fn); };
+
 	/**
 	 * @brief Override the default serial port used to connect to the GPS. Default is Serial1.
 	 */
@@ -149,6 +238,38 @@ public:
 	 */
 	AssetTrackerBase &withI2C(TwoWire &wire = Wire, uint8_t addr = 0x42);
 
+	/**
+	 * @brief Enable or disable passing the GPS data to TinyGPS++ (the NMEA parser)
+	 *
+	 * @param enable true to parse NMEA (default), false to only pass the data to the external decoder
+	 *
+	 * This is turned off by Ublox::setUbxOnly() when the GPS no longer outputs NMEA. It can be called
+	 * from any thread.
+	 */
+	void setNmeaParser(bool enable) { nmeaParser = enable; };
+
+	/**
+	 * @brief Returns true if the GPS data is passed to TinyGPS++ (the NMEA parser)
+	 */
+	bool getNmeaParser() const { return nmeaParser; };
+
+	/**
+	 * @brief Returns true if the GPS is connected by I2C (DDC) instead of serial
+	 */
+	bool usingI2C() const { return useWire; };
+
+	/**
+	 * @brief Change the MCU serial port baud rate. Does not change the GPS.
+	 *
+	 * Use Ublox::setBaudRate() to change both. Before begin(), this sets the rate that begin() uses.
+	 */
+	void setSerialBaud(uint32_t baud);
+
+	/**
+	 * @brief Gets the current MCU serial port baud rate
+	 */
+	uint32_t getSerialBaud() const { return serialBaud; };
+
 	AssetTrackerBase &withGNSSExtInt(pin_t extIntPin) { this->extIntPin = extIntPin; return *this; };
 
 	/**
@@ -171,24 +292,129 @@ public:
 	 */
 	static AssetTrackerBase *getInstance() { return instance; }; 
 
+	/**
+	 * @brief Maximum number of bytes to read from I2C at once (the size of the Wire buffer)
+	 */
+	static const size_t WIRE_CHUNK_SIZE = 32;
+
+	/**
+	 * @brief Maximum number of bytes to read from I2C before releasing the Wire lock to decode them
+	 */
+	static const size_t WIRE_BATCH_SIZE = 4 * WIRE_CHUNK_SIZE;
+
+	/**
+	 * @brief Maximum number of bytes to read from serial at once
+	 */
+	static const size_t SERIAL_CHUNK_SIZE = 64;
+
+	/**
+	 * @brief Size of the serial receive buffer in the system firmware
+	 */
+#ifdef SERIAL_BUFFER_SIZE
+	static const size_t SERIAL_RX_BUFFER_SIZE = SERIAL_BUFFER_SIZE;
+#else
+	static const size_t SERIAL_RX_BUFFER_SIZE = 64;
+#endif
+
+	/**
+	 * @brief Longest time the thread sleeps in I2C mode, since the u-blox buffers the data (milliseconds)
+	 */
+	static const unsigned long I2C_MAX_SLEEP_MS = 100;
+
+	/**
+	 * @brief Wake up this long before the next GPS burst is expected (milliseconds)
+	 */
+	static const unsigned long EPOCH_GUARD_MS = 20;
+
+	/**
+	 * @brief Data arriving after this much idle time starts a new GPS burst (milliseconds)
+	 */
+	static const unsigned long BURST_GAP_MS = 50;
+
+	/**
+	 * @brief Don't sleep past the serial buffer limit for this long after sending a command (milliseconds)
+	 */
+	static const unsigned long COMMAND_RESPONSE_MS = 1500;
+
 
 protected:
+	/**
+	 * @brief Reads the number of bytes available from the 0xFD and 0xFE registers. Must be called with wire locked.
+	 *
+	 * This leaves the register address at 0xFF, the data stream.
+	 */
 	uint16_t wireReadBytesAvailable();
-	int wireReadBytes(uint8_t *buf, size_t len);
+
+	/**
+	 * @brief Reads len bytes (at most WIRE_CHUNK_SIZE) from the current register address. Must be called with wire locked.
+	 *
+	 * @param stop true to send a stop condition after the read, false to keep the bus for another read
+	 *
+	 * Returns len on success or -1 on error.
+	 */
+	int wireReadBytes(uint8_t *buf, size_t len, bool stop);
 
 	void threadFunction();
 	static void threadFunctionStatic(void *param);
 
+	/**
+	 * @brief Updates the burst timing and buffer statistics after reading the GPS
+	 *
+	 * @param waiting The number of bytes that were waiting to be read
+	 *
+	 * @param count The number of bytes that were read
+	 */
+	void updateReadStats(size_t waiting, size_t count);
+
+	/**
+	 * @brief How long the GPS thread can sleep without losing data, in milliseconds
+	 */
+	unsigned long threadSleepTime() const;
+
+	/**
+	 * @brief Passes a block of data read from the GPS to TinyGPS++ and the external decoder
+	 *
+	 * With an external block decoder, the data is split into NMEA sentences and UBX frames and
+	 * each is passed to one decoder only. Otherwise all of it goes to both.
+	 *
+	 * Returns true if at least one sentence was completed.
+	 */
+	bool decodeBlock(const uint8_t *buf, size_t len);
+
+	/**
+	 * @brief Passes a range of NMEA data to TinyGPS++. Returns true if a sentence was completed.
+	 */
+	bool decodeNmea(const uint8_t *buf, size_t len);
+
+	void callFixCallbacks(TinyGPSSentenceType sentenceType);
+
 	TinyGPSPlus gps;
 	bool useWire = false;
+	std::atomic<bool> nmeaParser; 		//!< Set from the Ublox loop thread, read by the GPS thread
 	TwoWire &wire = Wire;
 	uint8_t wireAddr = 0x42;
 	USARTSerial &serialPort = Serial1;
 	Thread *thread = NULL;
 	std::function<bool(char)> externalDecoder = 0;
+	std::function<void(const uint8_t *, size_t)> externalBlockDecoder = 0;
+	UbloxNmeaDemux demux; 				//!< Splits NMEA and UBX when there is an external block decoder
 	std::vector<std::function<void()>> threadCallbacks;
 	std::vector<std::function<void()>> sentenceCallbacks;
+	std::vector<std::function<void(const FixSnapshot &, TinyGPSSentenceType)>> fixCallbacks;
 	pin_t extIntPin = PIN_INVALID;
+	uint32_t serialBaud;
+	bool serialStarted = false;
+	bool threadSleep = false;
+	pin_t dataReadyPin = PIN_INVALID;
+	os_queue_t wakeQueue = 0;
+	unsigned long lastDataMs = 0;
+	unsigned long burstStartMs = 0;
+	unsigned long epochPeriodMs = 0;
+	uint32_t burstBytes = 0;
+	unsigned long lastCommandMs = 0;
+	unsigned long statsSecondStart = 0;
+	uint32_t statsSecondWakeups = 0;
+	AssetTrackerThreadStats stats = {};
 	os_mutex_t mutex = 0;
 	static AssetTrackerBase *instance;
 };
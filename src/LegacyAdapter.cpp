@@ -35,6 +35,18 @@ float LegacyAdapter::convertToDegreesMinutes(double deg) const {
 	return (float)(floorPosDeg * 100.0 + minutes);
 }
 
+// static
+int32_t LegacyAdapter::convertToDegreesMinutesE5(int32_t degreesE7) {
+	// Same conversion as convertToDegreesMinutes. The fraction of a degree in 1e-7 units times 60 is
+	// minutes in 1e-7 units, and dividing by 100 gives 1e-5 minutes, so the fraction is multiplied by 0.6.
+	uint32_t posDegE7 = (degreesE7 < 0) ? (uint32_t)-(int64_t)degreesE7 : (uint32_t)degreesE7;
+
+	uint32_t wholeDeg = posDegE7 / 10000000;
+	uint32_t minutesE5 = ((posDegE7 % 10000000) * 3 + 2) / 5;
+
+	return (int32_t)(wholeDeg * 10000000 + minutesE5);
+}
+
 
 
 /*
@@ -32,6 +32,27 @@ public:
 	 */
 	float convertToDegreesMinutes(double deg) const;
 
+	/**
+	 * @brief Converts a value in 1e-7 degrees into the GPS DDMM.MMMMM format, times 100000, using integer math.
+	 *
+	 * For example, 424702177 (42.4702177 degrees) is 422821306 (4228.21306, 42 degrees 28.21306 minutes).
+	 * Like convertToDegreesMinutes() the result is always positive.
+	 */
+	static int32_t convertToDegreesMinutesE5(int32_t degreesE7);
+
+	/**
+	 * @brief Gets all of the fix data at once
+	 *
+	 * The getters below each read only their own field. If you need several values, for example to
+	 * build a publish payload, get a snapshot once and use its fields so all of the values are from
+	 * the same GPS epoch.
+	 */
+	FixSnapshot getFixSnapshot() const {
+		FixSnapshot snap;
+		gpsData.copyFixSnapshotTo(snap);
+		return snap;
+	}
+
 	/**
 	 * @brief Return the latitude in a GPS-style value DDMM.MMMMM format (degrees * 100 + minutes).
 	 *
@@ -39,7 +60,7 @@ public:
 	 * or check the sign of readLatDeg().
 	 */
 	float readLat(void) const {
-		return convertToDegreesMinutes(gpsData.getLocation().lat());
+		return convertToDegreesMinutesE5(gpsData.getLocation().latE7()) / 100000.0f;
 	}
 
 	/**
@@ -49,7 +70,7 @@ public:
 	 * or check the sign of readLonDeg().
 	 */
 	float readLon(void) const {
-		return convertToDegreesMinutes(gpsData.getLocation().lng());
+		return convertToDegreesMinutesE5(gpsData.getLocation().lngE7()) / 100000.0f;
 	}
 
 	/**
@@ -58,7 +79,7 @@ public:
 	 * Negative values are used for south latitude.
 	 */
 	float readLatDeg(void) const {
-		return (float) gpsData.getLocation().lat();
+		return gpsData.getLocation().latE7() / 10000000.0f;
 	}
 
 	/**
@@ -67,7 +88,7 @@ public:
 	 * Negative values are used for east longitude.
 	 */
 	float readLonDeg(void) const {
-		return (float) gpsData.getLocation().lng();
+		return gpsData.getLocation().lngE7() / 10000000.0f;
 	}
 
 	/**
@@ -82,35 +103,35 @@ public:
 	 */
 	float getSpeed() const {
 		// The Adafruit library does not check the validity and always returns the last speed
-		return (float) gpsData.getSpeed().knots();
+		return gpsData.getSpeed().centiKnots() / 100.0f;
 	}
 
 	/**
 	 * @brief Get the course angle in degrees 0 <= deg < 360
 	 */
 	float getAngle() const {
-		return (float) gpsData.getCourse().deg();
+		return gpsData.getCourse().centidegrees() / 100.0f;
 	}
 
 	/**
 	 * @brief Get the current hour (in UTC)
 	 */
 	uint8_t getHour() const {
-		return (uint8_t) gpsData.getTime().hour();
+		return (uint8_t) (gpsData.getTime().value() / 1000000);
 	}
 
 	/**
 	 * @brief Get the current minute (in UTC)
 	 */
 	uint8_t getMinute() const {
-		return (uint8_t) gpsData.getTime().minute();
+		return (uint8_t) ((gpsData.getTime().value() / 10000) % 100);
 	}
 
 	/**
 	 * @brief Get the current second (in UTC)
 	 */
 	uint8_t getSeconds() const {
-		return (uint8_t) gpsData.getTime().second();
+		return (uint8_t) ((gpsData.getTime().value() / 100) % 100);
 	}
 
 	/**
@@ -120,7 +141,7 @@ public:
 	 * so it's not useful for measuring the actual time to the nearest millisecond!
 	 */
 	uint16_t getMilliseconds() const {
-		return (uint16_t)gpsData.getTime().centisecond() * 10;
+		return (uint16_t) (gpsData.getTime().value() % 100) * 10;
 	}
 
 	/**
@@ -131,33 +152,33 @@ public:
 	 * The 4-digit year can be found with: getTinyGPSPlus()->getDate().year()
 	 */
 	uint8_t getYear() const {
-		return (uint8_t) (gpsData.getDate().year() % 100);
+		return (uint8_t) (gpsData.getDate().value() % 100);
 	}
 
 	/**
 	 * @brief Get the current month (1-12) (at UTC)
 	 */
 	uint8_t getMonth() const {
-		return (uint8_t) gpsData.getDate().month();
+		return (uint8_t) ((gpsData.getDate().value() / 100) % 100);
 	}
 
 	/**
 	 * @brief Get the current day of month (1-31) (at UTC)
 	 */
 	uint8_t getDay() const {
-		return (uint8_t) gpsData.getDate().day();
+		return (uint8_t) (gpsData.getDate().value() / 10000);
 	}
 
 	/**
 	 * @brief Returns the number of milliseconds since the last GPS reading
 	 */
 	uint32_t getGpsTimestamp() const {
-		TinyGPSTime time = gpsData.getTime();
+		uint32_t time = gpsData.getTime().value();
 
 		// Return timestamp in milliseconds, from last GPS reading
 		// 0 if no reading has been done
 		// (This returns the milliseconds of current day)
-		return time.hour() * 60 * 60 * 1000 + time.minute() * 60 * 1000 + time.second() * 1000 + time.centisecond() * 10;
+		return (time / 1000000) * 60 * 60 * 1000 + ((time / 10000) % 100) * 60 * 1000 + ((time / 100) % 100) * 1000 + (time % 100) * 10;
 	}
 
 	/**
@@ -179,18 +200,25 @@ public:
 	}
 
     /**
-     * @brief Gets the GPS accuracy
+     * @brief Gets the GPS accuracy in meters
+     *
+     * This is the horizontal accuracy estimate when the data comes from UBX-NAV-PVT, otherwise
+     * it's estimated from the HDOP.
      */
 	float getGpsAccuracy() const {
+		TinyGPSAccuracy accuracy = gpsData.getAccuracy();
+		if (accuracy.isValid()) {
+			return accuracy.horizontal() / 1000.0f;
+		}
 		// 1.8 taken from specs at https://learn.adafruit.com/adafruit-ultimate-gps/
-		return 1.8 * readHDOP();
+		return 1.8f * readHDOP();
 	}
 
 	/**
 	 * @brief Get the altitude in meters
 	 */
 	float getAltitude() const {
-		return gpsData.getAltitude().meters();
+		return gpsData.getAltitude().centimeters() / 100.0f;
 	}
 
 	/**
@@ -199,7 +227,7 @@ public:
 	 * Geoid separation is difference between ellipsoid and mean sea level.
 	 */
 	float getGeoIdHeight() const {
-		return gpsData.getGeoidSeparation().meters();
+		return gpsData.getGeoidSeparation().centimeters() / 100.0f;
 	}
 
 	/**
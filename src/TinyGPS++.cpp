@@ -27,9 +27,6 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <ctype.h>
 #include <stdlib.h>
 
-#define _GPRMCterm   "GPRMC"
-#define _GPGGAterm   "GPGGA"
-
 // Stuff included in Ardiuno but not Particle:
 #ifndef SPARK_WIRING_ARDUINO_CONSTANTS_H
 double radians(double deg) {
@@ -49,17 +46,90 @@ TinyGPSPlus::TinyGPSPlus()
   :  parity(0)
   ,  isChecksumTerm(false)
   ,  curSentenceType(GPS_SENTENCE_OTHER)
+  ,  curTalker(TinyGPSTalker::OTHER)
+  ,  curFormatter(TinyGPSSentenceType::OTHER)
   ,  curTermNumber(0)
   ,  curTermOffset(0)
   ,  sentenceHasFix(false)
-  ,  customElts(0)
+  ,  skipSentence(false)
+  ,  sentenceMask(SENTENCE_MASK_ALL)
+  ,  termInteger(0)
+  ,  termFraction(0)
+  ,  termFractionDigits(0)
+  ,  termNumberState(0)
+  ,  termNegative(false)
   ,  customCandidates(0)
+  ,  customCursor(0)
   ,  encodedCharCount(0)
   ,  sentencesWithFixCount(0)
   ,  failedChecksumCount(0)
   ,  passedChecksumCount(0)
+  ,  skippedSentenceCount(0)
+  ,  epochSentenceMask(0)
+  ,  epochSentencesSeen(0)
+  ,  epochStartTime(0)
+  ,  epochTimeoutMs(EPOCH_TIMEOUT_MS)
+  ,  epochSentenceType(TinyGPSSentenceType::OTHER)
 {
   term[0] = '\0';
+  memset(customIndex, 0, sizeof(customIndex));
+}
+
+// Number of fraction digits kept while accumulating a term, enough for DDMM.MMMMMMM
+#define _GPS_MAX_FRACTION_DIGITS 7
+
+// States of the term number accumulator
+enum {GPS_NUMBER_START, GPS_NUMBER_INTEGER, GPS_NUMBER_FRACTION, GPS_NUMBER_END};
+
+// Scales a fraction with n digits to _GPS_MAX_FRACTION_DIGITS digits
+static const uint32_t fractionScale[_GPS_MAX_FRACTION_DIGITS + 1] =
+  {10000000UL, 1000000UL, 100000UL, 10000UL, 1000UL, 100UL, 10UL, 1UL};
+
+inline void TinyGPSPlus::resetNumber()
+{
+  termInteger = termFraction = 0;
+  termFractionDigits = 0;
+  termNumberState = GPS_NUMBER_START;
+  termNegative = false;
+}
+
+// Folds one more character of the current term into the number accumulator. This
+// follows the same rules as parseDecimal and parseDegrees: an optional leading '-',
+// integer digits, then an optional '.' and fraction digits. Anything else ends the number.
+inline void TinyGPSPlus::accumulateNumber(char c)
+{
+  uint8_t digit = (uint8_t)(c - '0');
+
+  switch(termNumberState)
+  {
+  case GPS_NUMBER_START:
+    if (c == '-')
+    {
+      termNegative = true;
+      termNumberState = GPS_NUMBER_INTEGER;
+      break;
+    }
+    // fall through
+  case GPS_NUMBER_INTEGER:
+    if (digit <= 9)
+    {
+      termInteger = termInteger * 10 + digit;
+      termNumberState = GPS_NUMBER_INTEGER;
+    }
+    else
+      termNumberState = c == '.' ? GPS_NUMBER_FRACTION : GPS_NUMBER_END;
+    break;
+
+  case GPS_NUMBER_FRACTION:
+    if (digit > 9)
+      termNumberState = GPS_NUMBER_END;
+    else if (termFractionDigits < _GPS_MAX_FRACTION_DIGITS)
+    {
+      termFraction = termFraction * 10 + digit;
+      ++termFractionDigits;
+    }
+    break;
+  }
 }
 
 //
@@ -70,6 +140,13 @@ bool TinyGPSPlus::encode(char c)
 {
   ++encodedCharCount;
 
+  // Sentences not in the sentence mask only track parity until the checksum
+  if (skipSentence && !isChecksumTerm && c != '*' && c != '$' && c != '\r' && c != '\n')
+  {
+    parity ^= c;
+    return false;
+  }
+
   switch(c)
   {
   case ',': // term terminators
@@ -88,16 +165,23 @@ bool TinyGPSPlus::encode(char c)
       ++curTermNumber;
       curTermOffset = 0;
       isChecksumTerm = c == '*';
+      resetNumber();
       return isValidSentence;
     }
     break;
 
   case '$': // sentence begin
+    if (epochSentencesSeen)
+      checkEpochTimeout();
     curTermNumber = curTermOffset = 0;
     parity = 0;
     curSentenceType = GPS_SENTENCE_OTHER;
+    curTalker = TinyGPSTalker::OTHER;
+    curFormatter = TinyGPSSentenceType::OTHER;
     isChecksumTerm = false;
     sentenceHasFix = false;
+    skipSentence = false;
+    resetNumber();
     return false;
 
   default: // ordinary characters
@@ -105,15 +189,133 @@ bool TinyGPSPlus::encode(char c)
       term[curTermOffset++] = c;
     if (!isChecksumTerm)
       parity ^= c;
+    if (curSentenceType != GPS_SENTENCE_OTHER)
+      accumulateNumber(c);
     return false;
   }
 
   return false;
 }
 
+// A word with each byte set to c
+#define _GPS_REPEAT_BYTE(c) ((uint32_t)(uint8_t)(c) * 0x01010101UL)
+
+// Nonzero if any byte of the word is less than n (n <= 128)
+#define _GPS_HAS_LESS_BYTE(w, n) (((w) - _GPS_REPEAT_BYTE(n)) & ~(w) & 0x80808080UL)
+
+// Nonzero if any byte of the word is zero
+#define _GPS_HAS_ZERO_BYTE(w) _GPS_HAS_LESS_BYTE(w, 1)
+
+// All of the characters that encode(char) treats specially are less than this value
+#define _GPS_DELIMITER_LIMIT ('*' + 3)
+
+static inline bool isDelimiter(char c)
+{
+  return (uint8_t)c < _GPS_DELIMITER_LIMIT && (c == ',' || c == '*' || c == '\r' || c == '\n' || c == '$');
+}
+
+// Returns true if any of the 4 bytes in w is a delimiter
+static inline bool hasDelimiter(uint32_t w)
+{
+  // Most words have only digits, letters and '.' so the first test is usually enough
+  return _GPS_HAS_LESS_BYTE(w, _GPS_DELIMITER_LIMIT) &&
+         (_GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE(',')) |
+          _GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE('*')) |
+          _GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE('\r')) |
+          _GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE('\n')) |
+          _GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE('$'))) != 0;
+}
+
+// While skipping a sentence, commas are ordinary characters
+static inline bool isSkipDelimiter(char c)
+{
+  return (uint8_t)c < _GPS_DELIMITER_LIMIT && (c == '*' || c == '\r' || c == '\n' || c == '$');
+}
+
+static inline bool hasSkipDelimiter(uint32_t w)
+{
+  return _GPS_HAS_LESS_BYTE(w, _GPS_DELIMITER_LIMIT) &&
+         (_GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE('*')) |
+          _GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE('\r')) |
+          _GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE('\n')) |
+          _GPS_HAS_ZERO_BYTE(w ^ _GPS_REPEAT_BYTE('$'))) != 0;
+}
+
+size_t TinyGPSPlus::encode(const char *buf, size_t len)
+{
+  size_t sentences = 0;
+  const char *end = buf + len;
+
+  while (buf < end)
+  {
+    // Find the run of ordinary characters, a word at a time, accumulating its parity.
+    // A skipped sentence is one run all the way to the checksum.
+    bool skipping = skipSentence && !isChecksumTerm;
+    const char *run = buf;
+    uint32_t wordParity = 0;
+    while (end - buf >= (ptrdiff_t)sizeof(uint32_t))
+    {
+      uint32_t w;
+      memcpy(&w, buf, sizeof(w));
+      if (skipping ? hasSkipDelimiter(w) : hasDelimiter(w))
+        break;
+      wordParity ^= w;
+      buf += sizeof(w);
+    }
+    uint8_t runParity = (uint8_t)(wordParity ^ (wordParity >> 8) ^ (wordParity >> 16) ^ (wordParity >> 24));
+    while (buf < end && !(skipping ? isSkipDelimiter(*buf) : isDelimiter(*buf)))
+      runParity ^= (uint8_t)*buf++;
+
+    if (buf > run)
+    {
+      if (skipping)
+      {
+        encodedCharCount += buf - run;
+        parity ^= runParity;
+      }
+      else
+        appendTerm(run, buf - run, runParity);
+    }
+
+    // Delimiters go through the regular state machine
+    if (buf < end && encode(*buf++))
+      ++sentences;
+  }
+
+  return sentences;
+}
+
+bool TinyGPSPlus::checkEpochTimeout()
+{
+  if (epochSentencesSeen == 0 || millis() - epochStartTime < epochTimeoutMs)
+    return false;
+
+  publish(epochSentenceType);
+  return true;
+}
+
 //
 // internal utilities
 //
+
+// Adds a run of ordinary characters to the current term, same as the default case of encode(char)
+void TinyGPSPlus::appendTerm(const char *run, size_t len, uint8_t runParity)
+{
+  encodedCharCount += len;
+
+  if (curSentenceType != GPS_SENTENCE_OTHER)
+    for (size_t ii = 0; ii < len; ii++)
+      accumulateNumber(run[ii]);
+
+  // Terms are short, so a simple loop is faster than memcpy here
+  const char *runEnd = run + len;
+  while (run < runEnd && curTermOffset < sizeof(term) - 1)
+    term[curTermOffset++] = *run++;
+
+  if (!isChecksumTerm)
+    parity ^= runParity;
+}
+
 int TinyGPSPlus::fromHex(char a)
 {
   if (a >= 'A' && a <= 'F')
@@ -166,6 +368,107 @@ void TinyGPSPlus::parseDegrees(const char *term, RawDegrees &deg)
   deg.negative = false;
 }
 
+// Same result as parseDecimal(term), but from the number accumulated while the term arrived
+int32_t TinyGPSPlus::termDecimal() const
+{
+  int32_t ret = 100 * (int32_t)termInteger + (int32_t)(termFraction * fractionScale[termFractionDigits] / 100000UL);
+  return termNegative ? -ret : ret;
+}
+
+// Same result as parseDegrees(term, deg), but from the number accumulated while the term arrived
+void TinyGPSPlus::termDegrees(RawDegrees &deg) const
+{
+  uint16_t minutes = (uint16_t)(termInteger % 100);
+  uint32_t tenMillionthsOfMinutes = minutes * 10000000UL + termFraction * fractionScale[termFractionDigits];
+
+  deg.deg = (int16_t)(termInteger / 100);
+  deg.billionths = (5 * tenMillionthsOfMinutes + 1) / 3;
+  deg.negative = false;
+}
+
+// Sentence name parts packed into integers so they can be matched by a switch
+#define _GPS_TALKER_ID(a, b) (((uint16_t)(uint8_t)(a) << 8) | (uint8_t)(b))
+#define _GPS_FORMATTER_ID(a, b, c) (((uint32_t)(uint8_t)(a) << 16) | ((uint32_t)(uint8_t)(b) << 8) | (uint8_t)(c))
+
+// Sets talker and formatter from a sentence name like "GNRMC". Either is OTHER if not recognized,
+// and formatter is also OTHER if the talker is not recognized.
+void TinyGPSPlus::parseSentenceName(const char *name, size_t len, TinyGPSTalker &talker, TinyGPSSentenceType &formatter)
+{
+  talker = TinyGPSTalker::OTHER;
+  formatter = TinyGPSSentenceType::OTHER;
+
+  // Standard sentence names are a 2 character talker and a 3 character formatter
+  if (len != 5)
+    return;
+
+  switch(_GPS_TALKER_ID(name[0], name[1]))
+  {
+  case _GPS_TALKER_ID('G', 'P'): talker = TinyGPSTalker::GP; break;
+  case _GPS_TALKER_ID('G', 'N'): talker = TinyGPSTalker::GN; break;
+  case _GPS_TALKER_ID('G', 'L'): talker = TinyGPSTalker::GL; break;
+  case _GPS_TALKER_ID('G', 'A'): talker = TinyGPSTalker::GA; break;
+  case _GPS_TALKER_ID('G', 'B'): talker = TinyGPSTalker::GB; break;
+  case _GPS_TALKER_ID('G', 'Q'): talker = TinyGPSTalker::GQ; break;
+  default: return;
+  }
+
+  switch(_GPS_FORMATTER_ID(name[2], name[3], name[4]))
+  {
+  case _GPS_FORMATTER_ID('R', 'M', 'C'): formatter = TinyGPSSentenceType::RMC; break;
+  case _GPS_FORMATTER_ID('G', 'G', 'A'): formatter = TinyGPSSentenceType::GGA; break;
+  case _GPS_FORMATTER_ID('G', 'S', 'A'): formatter = TinyGPSSentenceType::GSA; break;
+  case _GPS_FORMATTER_ID('G', 'S', 'V'): formatter = TinyGPSSentenceType::GSV; break;
+  case _GPS_FORMATTER_ID('V', 'T', 'G'): formatter = TinyGPSSentenceType::VTG; break;
+  case _GPS_FORMATTER_ID('G', 'L', 'L'): formatter = TinyGPSSentenceType::GLL; break;
+  case _GPS_FORMATTER_ID('Z', 'D', 'A'): formatter = TinyGPSSentenceType::ZDA; break;
+  case _GPS_FORMATTER_ID('T', 'X', 'T'): formatter = TinyGPSSentenceType::TXT; break;
+  default: return;
+  }
+}
+
+// Sets curTalker, curFormatter and curSentenceType from the sentence name in term
+void TinyGPSPlus::identifySentence()
+{
+  curSentenceType = GPS_SENTENCE_OTHER;
+
+  parseSentenceName(term, curTermOffset, curTalker, curFormatter);
+
+  // Location data is only taken from GPS or combined GNSS solutions
+  if (curTalker == TinyGPSTalker::GP || curTalker == TinyGPSTalker::GN)
+  {
+    if (curFormatter == TinyGPSSentenceType::RMC)
+      curSentenceType = GPS_SENTENCE_GPRMC;
+    else if (curFormatter == TinyGPSSentenceType::GGA)
+      curSentenceType = GPS_SENTENCE_GPGGA;
+  }
+}
+
+// Makes the data in tempData visible to the accessors and notifies the publish callback
+void TinyGPSPlus::publish(TinyGPSSentenceType sentenceType)
+{
+  publishLock.writeBegin();
+  TinyGPSData::operator=(tempData);
+  publishLock.writeEnd();
+  epochSentencesSeen = 0;
+
+  if (publishCallback)
+    publishCallback(sentenceType);
+}
+
+// Called after an RMC or GGA sentence is committed to tempData. Publishes if that completes the epoch.
+void TinyGPSPlus::endOfEpochSentence()
+{
+  if (epochSentencesSeen == 0)
+    epochStartTime = millis();
+  epochSentencesSeen |= sentenceBit(curFormatter);
+  epochSentenceType = curFormatter;
+
+  // Sentences skipped by the sentence mask will never arrive, so don't wait for them
+  uint32_t expected = epochSentenceMask & sentenceMask;
+  if ((epochSentencesSeen & expected) == expected)
+    publish(curFormatter);
+}
+
 #define COMBINE(sentence_type, term_number) (((unsigned)(sentence_type) << 5) | term_number)
 
 // Processes a just-completed term
@@ -178,10 +481,20 @@ bool TinyGPSPlus::endOfTermHandler()
     byte checksum = 16 * fromHex(term[0]) + fromHex(term[1]);
     if (checksum == parity)
     {
+      if (skipSentence)
+      {
+        ++skippedSentenceCount;
+        return false;
+      }
+
       passedChecksumCount++;
       if (sentenceHasFix)
         ++sentencesWithFixCount;
 
+      // A sentence from a new epoch first publishes what was collected for the previous one
+      if (epochSentencesSeen && curSentenceType != GPS_SENTENCE_OTHER && tempData.time.newTime != tempData.time.time)
+        publish(epochSentenceType);
+
       switch(curSentenceType)
       {
       case GPS_SENTENCE_GPRMC:
@@ -199,9 +512,7 @@ bool TinyGPSPlus::endOfTermHandler()
             tempData.speed.invalidate();
             tempData.course.invalidate();
         }
-        SINGLE_THREADED_BLOCK() {
-        	TinyGPSData::operator=(tempData);
-        }
+        endOfEpochSentence();
         break;
       case GPS_SENTENCE_GPGGA:
         tempData.time.commit();
@@ -219,14 +530,12 @@ bool TinyGPSPlus::endOfTermHandler()
         }
         tempData.satellites.commit();
         tempData.hdop.commit();
-        SINGLE_THREADED_BLOCK() {
-        	TinyGPSData::operator=(tempData);
-        }
+        endOfEpochSentence();
         break;
       }
 
       // Commit all custom listeners of this sentence type
-      for (TinyGPSCustom *p = customCandidates; p != NULL && strcmp(p->sentenceName, customCandidates->sentenceName) == 0; p = p->next)
+      for (TinyGPSCustom *p = customCandidates; p != NULL; p = p->next)
          p->commit();
       return true;
     }
@@ -242,17 +551,14 @@ bool TinyGPSPlus::endOfTermHandler()
   // the first term determines the sentence type
   if (curTermNumber == 0)
   {
-    if (!strcmp(term, _GPRMCterm) || !strcmp(term, "GNRMC"))
-      curSentenceType = GPS_SENTENCE_GPRMC;
-    else if (!strcmp(term, _GPGGAterm) ||!strcmp(term, "GNGGA"))
-      curSentenceType = GPS_SENTENCE_GPGGA;
-    else
-      curSentenceType = GPS_SENTENCE_OTHER;
+    identifySentence();
 
     // Any custom candidates of this sentence type?
-    for (customCandidates = customElts; customCandidates != NULL && strcmp(customCandidates->sentenceName, term) < 0; customCandidates = customCandidates->next);
-    if (customCandidates != NULL && strcmp(customCandidates->sentenceName, term) > 0)
-       customCandidates = NULL;
+    for (customCandidates = *customBucket(curFormatter); customCandidates != NULL && !customMatches(customCandidates, curTalker, term); customCandidates = customCandidates->nextSentence);
+    customCursor = customCandidates;
+
+    // Skip the rest of the sentence if nobody wants it
+    skipSentence = customCandidates == NULL && (sentenceMask & sentenceBit(curFormatter)) == 0;
 
     return false;
   }
@@ -262,14 +568,14 @@ bool TinyGPSPlus::endOfTermHandler()
   {
     case COMBINE(GPS_SENTENCE_GPRMC, 1): // Time in both sentences
     case COMBINE(GPS_SENTENCE_GPGGA, 1):
-	  tempData.time.setTime(term);
+      tempData.time.newTime = (uint32_t)termDecimal();
       break;
     case COMBINE(GPS_SENTENCE_GPRMC, 2): // GPRMC validity
       sentenceHasFix = term[0] == 'A';
       break;
     case COMBINE(GPS_SENTENCE_GPRMC, 3): // Latitude
     case COMBINE(GPS_SENTENCE_GPGGA, 2):
-      tempData.location.setLatitude(term);
+      termDegrees(tempData.location.rawNewLatData);
       break;
     case COMBINE(GPS_SENTENCE_GPRMC, 4): // N/S
     case COMBINE(GPS_SENTENCE_GPGGA, 3):
@@ -277,42 +583,42 @@ bool TinyGPSPlus::endOfTermHandler()
       break;
     case COMBINE(GPS_SENTENCE_GPRMC, 5): // Longitude
     case COMBINE(GPS_SENTENCE_GPGGA, 4):
-      tempData.location.setLongitude(term);
+      termDegrees(tempData.location.rawNewLngData);
       break;
     case COMBINE(GPS_SENTENCE_GPRMC, 6): // E/W
     case COMBINE(GPS_SENTENCE_GPGGA, 5):
       tempData.location.rawNewLngData.negative = term[0] == 'W';
       break;
     case COMBINE(GPS_SENTENCE_GPRMC, 7): // Speed (GPRMC)
-	  tempData.speed.set(term);
+      tempData.speed.newval = termDecimal();
       break;
     case COMBINE(GPS_SENTENCE_GPRMC, 8): // Course (GPRMC)
-	  tempData.course.set(term);
+      tempData.course.newval = termDecimal();
       break;
     case COMBINE(GPS_SENTENCE_GPRMC, 9): // Date (GPRMC)
-	  tempData.date.setDate(term);
+      tempData.date.newDate = termInteger;
       break;
     case COMBINE(GPS_SENTENCE_GPGGA, 6): // Fix data (GPGGA)
       sentenceHasFix = term[0] > '0';
       break;
     case COMBINE(GPS_SENTENCE_GPGGA, 7): // Satellites used (GPGGA)
-	  tempData.satellites.set(term);
+      tempData.satellites.newval = termInteger;
       break;
     case COMBINE(GPS_SENTENCE_GPGGA, 8): // HDOP
-	  tempData.hdop.set(term);
+      tempData.hdop.newval = termDecimal();
       break;
     case COMBINE(GPS_SENTENCE_GPGGA, 9): // Altitude (GPGGA)
-	  tempData.altitude.set(term);
+      tempData.altitude.newval = termDecimal();
       break;
     case COMBINE(GPS_SENTENCE_GPGGA, 11): // Geoid Separation (GPGGA) (difference between ellipsoid and mean sea level)
-	  tempData.geoidSeparation.set(term);
+      tempData.geoidSeparation.newval = termDecimal();
       break;
   }
 
-  // Set custom values as needed
-  for (TinyGPSCustom *p = customCandidates; p != NULL && strcmp(p->sentenceName, customCandidates->sentenceName) == 0 && p->termNumber <= curTermNumber; p = p->next)
-    if (p->termNumber == curTermNumber)
-         p->set(term);
+  // Set custom values as needed. Terms arrive in order, so the cursor only moves forward.
+  for (; customCursor != NULL && customCursor->termNumber <= curTermNumber; customCursor = customCursor->next)
+    if (customCursor->termNumber == curTermNumber)
+         customCursor->set(term);
 
   return false;
 }
@@ -370,22 +676,131 @@ const char *TinyGPSPlus::cardinal(double course)
   return directions[direction % 16];
 }
 
-void TinyGPSLocation::commit()
+// Converts raw degrees to signed units of 1e-7 degree
+static int32_t rawDegreesToE7(const RawDegrees &raw)
+{
+  int32_t ret = (int32_t)raw.deg * 10000000L + (int32_t)((raw.billionths + 50) / 100);
+  return raw.negative ? -ret : ret;
+}
+
+// Days since 1970-01-01 for a date in the proleptic Gregorian calendar
+static int32_t daysFromCivil(int32_t year, uint32_t month, uint32_t day)
+{
+  year -= month <= 2;
+  int32_t era = (year >= 0 ? year : year - 399) / 400;
+  uint32_t yoe = (uint32_t)(year - era * 400);
+  uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+void TinyGPSData::copyFixSnapshotTo(FixSnapshot &snap) const
+{
+  RawDegrees rawLat, rawLng;
+  uint32_t locationCommitTime;
+
+  uint32_t start;
+  do {
+    start = publishLock.readBegin();
+    snap.locationValid = location.valid;
+    rawLat = location.rawLatData;
+    rawLng = location.rawLngData;
+    locationCommitTime = location.lastCommitTime;
+    snap.altitude = altitude.val;
+    snap.geoidSeparation = geoidSeparation.val;
+    snap.speed = speed.val;
+    snap.course = course.val;
+    snap.hdop = hdop.val;
+    snap.pdop = pdop.val;
+    snap.satellites = satellites.val;
+    snap.dateValid = date.valid;
+    snap.timeValid = time.valid;
+    snap.date = date.date;
+    snap.time = time.time;
+    snap.accuracyValid = accuracy.valid;
+    snap.horizontalAccuracy = accuracy.hAcc;
+    snap.verticalAccuracy = accuracy.vAcc;
+    snap.speedAccuracy = accuracy.sAcc;
+  } while (publishLock.readRetry(start));
+
+  snap.latitudeE7 = rawDegreesToE7(rawLat);
+  snap.longitudeE7 = rawDegreesToE7(rawLng);
+  snap.locationAge = snap.locationValid ? millis() - locationCommitTime : (uint32_t)ULONG_MAX;
+
+  snap.utcEpoch = 0;
+  if (snap.dateValid && snap.timeValid)
+  {
+    int32_t days = daysFromCivil(2000 + snap.date % 100, (snap.date / 100) % 100, snap.date / 10000);
+    snap.utcEpoch = (uint32_t)days * 86400UL + (snap.time / 1000000) * 3600UL + ((snap.time / 10000) % 100) * 60UL + (snap.time / 100) % 100;
+  }
+}
+
+// Converts signed units of 1e-7 degree to raw degrees
+static void e7ToRawDegrees(int32_t e7, RawDegrees &raw)
 {
-   rawLatData = rawNewLatData;
-   rawLngData = rawNewLngData;
-   lastCommitTime = millis();
-   valid = updated = true;
+  uint32_t pos = (e7 < 0) ? (uint32_t)-(int64_t)e7 : (uint32_t)e7;
+  raw.deg = (uint16_t)(pos / 10000000);
+  raw.billionths = (pos % 10000000) * 100;
+  raw.negative = (e7 < 0);
 }
 
-void TinyGPSLocation::setLatitude(const char *term)
+void TinyGPSPlus::encodeNavSolution(const TinyGPSNavSolution &sol)
 {
-   TinyGPSPlus::parseDegrees(term, rawNewLatData);
+  if (sol.dateValid)
+  {
+    tempData.date.newDate = sol.date;
+    tempData.date.commit();
+  }
+  if (sol.timeValid)
+  {
+    tempData.time.newTime = sol.time;
+    tempData.time.commit();
+  }
+
+  if (sol.fixValid)
+  {
+    e7ToRawDegrees(sol.latitudeE7, tempData.location.rawNewLatData);
+    e7ToRawDegrees(sol.longitudeE7, tempData.location.rawNewLngData);
+    tempData.location.commit();
+    tempData.speed.newval = sol.speed;
+    tempData.speed.commit();
+    tempData.course.newval = sol.course;
+    tempData.course.commit();
+    tempData.altitude.newval = sol.altitude;
+    tempData.altitude.commit();
+    tempData.geoidSeparation.newval = sol.geoidSeparation;
+    tempData.geoidSeparation.commit();
+  }
+  else
+  {
+    tempData.location.invalidate();
+    tempData.speed.invalidate();
+    tempData.course.invalidate();
+    tempData.altitude.invalidate();
+    tempData.geoidSeparation.invalidate();
+  }
+  tempData.satellites.newval = sol.satellites;
+  tempData.satellites.commit();
+  // NAV-PVT has no HDOP, so the HDOP from GGA (if enabled) is left as it is
+  tempData.pdop.newval = sol.pdop;
+  tempData.pdop.commit();
+
+  tempData.accuracy.hAcc = sol.horizontalAccuracy;
+  tempData.accuracy.vAcc = sol.verticalAccuracy;
+  tempData.accuracy.sAcc = sol.speedAccuracy;
+  tempData.accuracy.fix = sol.fixType;
+  tempData.accuracy.commit();
+
+  // The solution is a complete epoch, which replaces any NMEA sentences collected for it
+  publish(TinyGPSSentenceType::NAV_PVT);
 }
 
-void TinyGPSLocation::setLongitude(const char *term)
+void TinyGPSLocation::commit()
 {
-   TinyGPSPlus::parseDegrees(term, rawNewLngData);
+   rawLatData = rawNewLatData;
+   rawLngData = rawNewLngData;
+   lastCommitTime = millis();
+   valid = updated = true;
 }
 
 double TinyGPSLocation::lat()
@@ -402,6 +817,18 @@ double TinyGPSLocation::lng()
    return rawLngData.negative ? -ret : ret;
 }
 
+int32_t TinyGPSLocation::latE7()
+{
+   updated = false;
+   return rawDegreesToE7(rawLatData);
+}
+
+int32_t TinyGPSLocation::lngE7()
+{
+   updated = false;
+   return rawDegreesToE7(rawLngData);
+}
+
 void TinyGPSDate::commit()
 {
    date = newDate;
@@ -416,16 +843,6 @@ void TinyGPSTime::commit()
    valid = updated = true;
 }
 
-void TinyGPSTime::setTime(const char *term)
-{
-   newTime = (uint32_t)TinyGPSPlus::parseDecimal(term);
-}
-
-void TinyGPSDate::setDate(const char *term)
-{
-   newDate = atol(term);
-}
-
 uint16_t TinyGPSDate::year()
 {
    updated = false;
@@ -476,9 +893,10 @@ void TinyGPSDecimal::commit()
    valid = updated = true;
 }
 
-void TinyGPSDecimal::set(const char *term)
+void TinyGPSAccuracy::commit()
 {
-   newval = TinyGPSPlus::parseDecimal(term);
+   lastCommitTime = millis();
+   valid = updated = true;
 }
 
 void TinyGPSInteger::commit()
@@ -488,11 +906,6 @@ void TinyGPSInteger::commit()
    valid = updated = true;
 }
 
-void TinyGPSInteger::set(const char *term)
-{
-   newval = atol(term);
-}
-
 TinyGPSCustom::TinyGPSCustom(TinyGPSPlus &gps, const char *_sentenceName, int _termNumber)
 {
    begin(gps, _sentenceName, _termNumber);
@@ -523,17 +936,49 @@ void TinyGPSCustom::set(const char *term)
    strncpy(this->stagingBuffer, term, sizeof(this->stagingBuffer));
 }
 
+// Returns true if custom is for the sentence with this talker and name. Standard sentences are
+// matched by their parsed IDs, and the name is only compared in the OTHER bucket.
+bool TinyGPSPlus::customMatches(const TinyGPSCustom *custom, TinyGPSTalker talker, const char *sentenceName)
+{
+   if (custom->formatter != TinyGPSSentenceType::OTHER)
+      return custom->talker == talker;
+   return strcmp(custom->sentenceName, sentenceName) == 0;
+}
+
 void TinyGPSPlus::insertCustom(TinyGPSCustom *pElt, const char *sentenceName, int termNumber)
 {
    TinyGPSCustom **ppelt;
 
-   for (ppelt = &this->customElts; *ppelt != NULL; ppelt = &(*ppelt)->next)
-   {
-      int cmp = strcmp(sentenceName, (*ppelt)->sentenceName);
-      if (cmp < 0 || (cmp == 0 && termNumber < (*ppelt)->termNumber))
+   // Find the list for this sentence
+   parseSentenceName(sentenceName, strlen(sentenceName), pElt->talker, pElt->formatter);
+
+   for (ppelt = customBucket(pElt->formatter); *ppelt != NULL; ppelt = &(*ppelt)->nextSentence)
+      if (customMatches(*ppelt, pElt->talker, sentenceName))
          break;
+
+   if (*ppelt == NULL)
+   {
+      // First custom for this sentence
+      pElt->next = NULL;
+      pElt->nextSentence = NULL;
+      *ppelt = pElt;
+      return;
    }
 
+   // Keep the list sorted by term number. Only the first item in the list links to the next sentence.
+   TinyGPSCustom **ppfirst = ppelt;
+   TinyGPSCustom *first = *ppfirst;
+   for (; *ppelt != NULL; ppelt = &(*ppelt)->next)
+      if (termNumber < (*ppelt)->termNumber)
+         break;
+
    pElt->next = *ppelt;
+   pElt->nextSentence = NULL;
    *ppelt = pElt;
+
+   if (*ppfirst == pElt)
+   {
+      pElt->nextSentence = first->nextSentence;
+      first->nextSentence = NULL;
+   }
 }
@@ -27,6 +27,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "Particle.h"
 #include <limits.h>
 #include <math.h>
+#include <atomic>
+#include <functional>
 
 #define _GPS_VERSION "0.92" // software version of this library
 #define _GPS_MPH_PER_KNOT 1.15077945 // miles per hour
@@ -65,6 +67,7 @@ public:
 struct TinyGPSLocation
 {
 	friend class TinyGPSPlus;
+	friend class TinyGPSData;
 public:
 	/**
 	 * @brief Returns true if the data is valid
@@ -132,6 +135,26 @@ public:
 	 */
 	double lng();
 
+	/**
+	 * @brief Returns the latitude in units of 1e-7 degrees as a signed integer
+	 *
+	 * Positive values are for north latitude. Negative values are for south latitude.
+	 * This is calculated from the raw latitude with integer math only.
+	 *
+	 * This method is not const because it clears the updated flag.
+	 */
+	int32_t latE7();
+
+	/**
+	 * @brief Returns the longitude in units of 1e-7 degrees as a signed integer
+	 *
+	 * Negative values are for west longitude.
+	 * This is calculated from the raw longitude with integer math only.
+	 *
+	 * This method is not const because it clears the updated flag.
+	 */
+	int32_t lngE7();
+
 	/**
 	 * @brief Sets the valid flag to false (marks data as invalid)
 	 *
@@ -151,8 +174,6 @@ private:
 	RawDegrees rawLatData, rawLngData, rawNewLatData, rawNewLngData;
 	uint32_t lastCommitTime;
 	void commit();
-	void setLatitude(const char *term);
-	void setLongitude(const char *term);
 };
 
 /**
@@ -162,6 +183,7 @@ private:
 struct TinyGPSDate
 {
 	friend class TinyGPSPlus;
+	friend class TinyGPSData;
 public:
 	/**
 	 * @brief Returns true if the data is valid
@@ -229,7 +251,6 @@ private:
 	uint32_t newDate;
 	uint32_t lastCommitTime;
 	void commit();
-	void setDate(const char *term);
 };
 
 /**
@@ -238,6 +259,7 @@ private:
 struct TinyGPSTime
 {
 	friend class TinyGPSPlus;
+	friend class TinyGPSData;
 public:
 	/**
 	 * @brief Returns true if the data is valid
@@ -309,7 +331,6 @@ private:
 	uint32_t time, newTime;
 	uint32_t lastCommitTime;
 	void commit();
-	void setTime(const char *term);
 };
 
 /**
@@ -318,6 +339,7 @@ private:
 struct TinyGPSDecimal
 {
 	friend class TinyGPSPlus;
+	friend class TinyGPSData;
 public:
 	/**
 	 * @brief Returns true if the data is valid
@@ -368,7 +390,6 @@ private:
 	uint32_t lastCommitTime;
 	int32_t val, newval;
 	void commit();
-	void set(const char *term);
 };
 
 /**
@@ -377,6 +398,7 @@ private:
 struct TinyGPSInteger
 {
 	friend class TinyGPSPlus;
+	friend class TinyGPSData;
 public:
 	/**
 	 * @brief Returns true if the data is valid
@@ -427,7 +449,6 @@ private:
 	uint32_t lastCommitTime;
 	uint32_t val, newval;
 	void commit();
-	void set(const char *term);
 };
 
 /**
@@ -454,6 +475,16 @@ struct TinyGPSSpeed : TinyGPSDecimal
 	 * @brief Returns the speed in kilometers per hour
 	 */
 	double kmph()     { return _GPS_KMPH_PER_KNOT * value() / 100.0; }
+
+	/**
+	 * @brief Returns the speed in hundredths of a knot (integer)
+	 */
+	int32_t centiKnots() { return value(); }
+
+	/**
+	 * @brief Returns the speed in millimeters per second (integer)
+	 */
+	int32_t mmps()    { return (value() * 1852 + 180) / 360; }
 };
 
 /**
@@ -467,6 +498,13 @@ struct TinyGPSCourse : public TinyGPSDecimal
 	 * 0 <= deg < 360
 	 */
 	double deg()      { return value() / 100.0; }
+
+	/**
+	 * @brief Returns the course in hundredths of a degree (integer)
+	 *
+	 * 0 <= centidegrees < 36000
+	 */
+	int32_t centidegrees() { return value(); }
 };
 
 /**
@@ -493,10 +531,112 @@ struct TinyGPSAltitude : TinyGPSDecimal
 	 * @brief Returns the altitude in feet as a double floating point value.
 	 */
 	double feet()         { return _GPS_FEET_PER_METER * value() / 100.0; }
+
+	/**
+	 * @brief Returns the altitude in centimeters (integer)
+	 */
+	int32_t centimeters() { return value(); }
+};
+
+/**
+ * @brief Class to hold the accuracy estimates from the GPS
+ *
+ * These are only available from u-blox UBX-NAV-PVT, not from NMEA sentences.
+ */
+struct TinyGPSAccuracy
+{
+	friend class TinyGPSPlus;
+	friend class TinyGPSData;
+public:
+	/**
+	 * @brief Returns true if the data is valid
+	 */
+	bool isValid() const    { return valid; }
+
+	/**
+	 * @brief Returns true if the value has been updated.
+	 *
+	 * Getting a value clears the updated flag, and commiting a change sets it.
+	 */
+	bool isUpdated() const  { return updated; }
+
+	/**
+	 * @brief Returns the age of the value in milliseconds
+	 *
+	 * If the value is not valid, then ULONG_MAX is returned.
+	 */
+	uint32_t age() const    { return valid ? millis() - lastCommitTime : (uint32_t)ULONG_MAX; }
+
+	/**
+	 * @brief Horizontal accuracy estimate in millimeters (hAcc)
+	 */
+	uint32_t horizontal()   { updated = false; return hAcc; }
+
+	/**
+	 * @brief Vertical accuracy estimate in millimeters (vAcc)
+	 */
+	uint32_t vertical()     { updated = false; return vAcc; }
+
+	/**
+	 * @brief Speed accuracy estimate in millimeters per second (sAcc)
+	 */
+	uint32_t speed()        { updated = false; return sAcc; }
+
+	/**
+	 * @brief GNSS fix type (0 = no fix, 1 = dead reckoning only, 2 = 2D, 3 = 3D, 4 = GNSS + dead reckoning, 5 = time only)
+	 */
+	uint8_t fixType()       { updated = false; return fix; }
+
+	/**
+	 * @brief Sets the valid flag to false (marks data as invalid)
+	 */
+	void invalidate() { valid = false; }
+
+	/**
+	 * @brief Constructor
+	 */
+	TinyGPSAccuracy() : valid(false), updated(false), lastCommitTime(0), hAcc(0), vAcc(0), sAcc(0), fix(0)
+	{}
+
+private:
+	bool valid, updated;
+	uint32_t lastCommitTime;
+	uint32_t hAcc, vAcc, sAcc;
+	uint8_t fix;
+	void commit();
 };
 
 class TinyGPSPlus; // Forward declaration
 
+/**
+ * @brief NMEA talker ID, the first two characters of the sentence name ("GN" in "GNRMC")
+ */
+enum class TinyGPSTalker : uint8_t {
+	GP,			//!< GPS
+	GN,			//!< Multiple GNSS (combined solution)
+	GL,			//!< GLONASS
+	GA,			//!< Galileo
+	GB,			//!< BeiDou
+	GQ,			//!< QZSS
+	OTHER		//!< Proprietary or unknown talker
+};
+
+/**
+ * @brief NMEA sentence formatter, the last three characters of the sentence name ("RMC" in "GNRMC")
+ */
+enum class TinyGPSSentenceType : uint8_t {
+	RMC,		//!< Recommended minimum data
+	GGA,		//!< Fix data
+	GSA,		//!< DOP and active satellites
+	GSV,		//!< Satellites in view
+	VTG,		//!< Course over ground and ground speed
+	GLL,		//!< Latitude and longitude
+	ZDA,		//!< Time and date
+	TXT,		//!< Text transmission
+	OTHER,		//!< Any other sentence
+	NAV_PVT		//!< u-blox UBX-NAV-PVT binary message, passed to TinyGPSPlus::encodeNavSolution()
+};
+
 /**
  * @brief Class parse and hold an arbitrary value. Typically subclassed.
  */
@@ -506,7 +646,8 @@ public:
 	/**
 	 * @brief Constructor
 	 */
-	TinyGPSCustom() : lastCommitTime(0), valid(false), updated(false), sentenceName(0), termNumber(0), next(0) {};
+	TinyGPSCustom() : lastCommitTime(0), valid(false), updated(false), sentenceName(0), termNumber(0),
+		talker(TinyGPSTalker::OTHER), formatter(TinyGPSSentenceType::OTHER), next(0), nextSentence(0) {};
 
 	/**
 	 * @brief Constructor
@@ -557,8 +698,171 @@ private:
 	bool valid, updated;
 	const char *sentenceName;
 	int termNumber;
+	TinyGPSTalker talker;			// parsed from sentenceName
+	TinyGPSSentenceType formatter;	// parsed from sentenceName, OTHER if not a standard sentence
 	friend class TinyGPSPlus;
-	TinyGPSCustom *next;
+	TinyGPSCustom *next;			// next custom for the same sentence, sorted by term number
+	TinyGPSCustom *nextSentence;	// first custom of the next sentence in the same bucket
+};
+
+/**
+ * @brief A consistent copy of the fix data, with everything already converted to fixed point
+ *
+ * Fill this in with TinyGPSData::copyFixSnapshotTo(). All of the values come from the same
+ * version of the data, so they are from the same GPS epoch. The values are kept even if the
+ * corresponding valid flag is false, the same as the TinyGPSLocation, TinyGPSSpeed, etc. objects.
+ */
+struct FixSnapshot
+{
+	bool locationValid; 		//!< true if the location is valid (the GPS has a fix)
+	uint32_t locationAge; 		//!< Milliseconds since the location was received, ULONG_MAX if not valid
+	int32_t latitudeE7; 		//!< Latitude in units of 1e-7 degrees, negative for south
+	int32_t longitudeE7; 		//!< Longitude in units of 1e-7 degrees, negative for west
+	int32_t altitude; 			//!< Altitude in centimeters
+	int32_t geoidSeparation; 	//!< Geoid separation in centimeters
+	int32_t speed; 				//!< Speed in hundredths of a knot
+	int32_t course; 			//!< Course in hundredths of a degree
+	int32_t hdop; 				//!< HDOP times 100
+	int32_t pdop; 				//!< PDOP times 100 (only from UBX-NAV-PVT)
+	uint32_t satellites; 		//!< Number of satellites
+	bool dateValid; 			//!< true if the date is valid
+	bool timeValid; 			//!< true if the time is valid
+	uint32_t date; 				//!< UTC date in the GPS DDMMYY format
+	uint32_t time; 				//!< UTC time in the GPS HHMMSSCC format (CC = centiseconds)
+	uint32_t utcEpoch; 			//!< Seconds since 1970-01-01 00:00:00 UTC, 0 if the date or time is not valid
+	bool accuracyValid; 		//!< true if the accuracy estimates are valid (only from UBX-NAV-PVT)
+	uint32_t horizontalAccuracy;//!< Horizontal accuracy estimate in millimeters
+	uint32_t verticalAccuracy; 	//!< Vertical accuracy estimate in millimeters
+	uint32_t speedAccuracy; 	//!< Speed accuracy estimate in millimeters per second
+
+	/**
+	 * @brief Latitude in degrees, negative for south
+	 */
+	double lat() const { return latitudeE7 / 10000000.0; }
+
+	/**
+	 * @brief Longitude in degrees, negative for west
+	 */
+	double lng() const { return longitudeE7 / 10000000.0; }
+
+	/**
+	 * @brief Constructor
+	 */
+	FixSnapshot() : locationValid(false), locationAge((uint32_t)ULONG_MAX), latitudeE7(0), longitudeE7(0),
+		altitude(0), geoidSeparation(0), speed(0), course(0), hdop(0), pdop(0), satellites(0),
+		dateValid(false), timeValid(false), date(0), time(0), utcEpoch(0),
+		accuracyValid(false), horizontalAccuracy(0), verticalAccuracy(0), speedAccuracy(0)
+	{}
+};
+
+/**
+ * @brief A navigation solution decoded from a binary message, for TinyGPSPlus::encodeNavSolution()
+ *
+ * The values are in the same units as TinyGPSData, so no conversion is needed to store them.
+ */
+struct TinyGPSNavSolution
+{
+	bool dateValid; 			//!< true if date is valid
+	bool timeValid; 			//!< true if time is valid
+	bool fixValid; 				//!< true if the location, speed, course and altitude are valid
+	uint32_t date; 				//!< UTC date in the GPS DDMMYY format
+	uint32_t time; 				//!< UTC time in the GPS HHMMSSCC format
+	int32_t latitudeE7; 		//!< Latitude in units of 1e-7 degrees, negative for south
+	int32_t longitudeE7; 		//!< Longitude in units of 1e-7 degrees, negative for west
+	int32_t altitude; 			//!< Altitude above mean sea level in centimeters
+	int32_t geoidSeparation; 	//!< Geoid separation in centimeters
+	int32_t speed; 				//!< Ground speed in hundredths of a knot
+	int32_t course; 			//!< Course in hundredths of a degree
+	int32_t pdop; 				//!< Position dilution of precision times 100, stored as getPDOP()
+	uint32_t satellites; 		//!< Number of satellites used
+	uint32_t horizontalAccuracy;//!< Horizontal accuracy estimate in millimeters
+	uint32_t verticalAccuracy; 	//!< Vertical accuracy estimate in millimeters
+	uint32_t speedAccuracy; 	//!< Speed accuracy estimate in millimeters per second
+	uint8_t fixType; 			//!< GNSS fix type, see TinyGPSAccuracy::fixType()
+};
+
+/**
+ * @brief Sequence counter used to publish TinyGPSData to other threads without locking
+ *
+ * The writer makes the sequence odd before it changes the data and even again when done. Readers
+ * copy the data and retry if the sequence was odd or changed during the copy. Readers never block
+ * the scheduler and the writer never waits for readers.
+ *
+ * Copying or assigning an object that contains a TinyGPSSeqLock does not copy the sequence.
+ */
+class TinyGPSSeqLock {
+public:
+	/**
+	 * @brief Constructor
+	 */
+	TinyGPSSeqLock() : sequence(0) {}
+
+	/**
+	 * @brief Copy constructor. The sequence belongs to the object it's in, so it's not copied.
+	 */
+	TinyGPSSeqLock(const TinyGPSSeqLock &) : sequence(0) {}
+
+	/**
+	 * @brief Assignment. The sequence belongs to the object it's in, so it's not copied.
+	 */
+	TinyGPSSeqLock &operator=(const TinyGPSSeqLock &) { return *this; }
+
+	/**
+	 * @brief Called by the writer before changing the protected data
+	 */
+	void writeBegin() {
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	/**
+	 * @brief Called by the writer after changing the protected data
+	 */
+	void writeEnd() {
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Called by a reader before copying the protected data
+	 *
+	 * If a write is in progress, yields so a lower priority writer thread can finish.
+	 *
+	 * Returns the sequence to pass to readRetry().
+	 */
+	uint32_t readBegin() const {
+		uint32_t start;
+		while((start = sequence.load(std::memory_order_acquire)) & 1) {
+			os_thread_yield();
+		}
+		return start;
+	}
+
+	/**
+	 * @brief Called by a reader after copying the protected data
+	 *
+	 * Returns true if the data changed during the copy and the copy must be done again.
+	 */
+	bool readRetry(uint32_t start) const {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return sequence.load(std::memory_order_relaxed) != start;
+	}
+
+	/**
+	 * @brief Returns a consistent copy of src, which must be protected by this sequence counter
+	 */
+	template<class T>
+	T read(const T &src) const {
+		T result;
+		uint32_t start;
+		do {
+			start = readBegin();
+			result = src;
+		} while(readRetry(start));
+		return result;
+	}
+
+private:
+	std::atomic<uint32_t> sequence;
 };
 
 /**
@@ -660,64 +964,64 @@ public:
 	 */
 	TinyGPSDecimal hdop;
 
+	/**
+	 * @brief Get the PDOP (only from UBX-NAV-PVT)
+	 *
+	 * While this field is public, you should instead use getPDOP(). In multi-threaded mode,
+	 * accessing this field directly is not safe, but for backward compatibility this field
+	 * remains public.
+	 */
+	TinyGPSDecimal pdop;
+
+	/**
+	 * @brief Get the accuracy estimates (only from UBX-NAV-PVT)
+	 *
+	 * While this field is public, you should instead use getAccuracy(). In multi-threaded mode,
+	 * accessing this field directly is not safe, but for backward compatibility this field
+	 * remains public.
+	 */
+	TinyGPSAccuracy accuracy;
+
 	/**
 	 * @brief Get the location (latitude and longitude)
 	 */
 	TinyGPSLocation getLocation() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return location;
-	    }
-	    return location;
+		return publishLock.read(location);
 	}
 
 	/**
 	 * @brief Get the date (year, month, day of month)
 	 */
 	TinyGPSDate getDate() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return date;
-	    }
-    	return date;
+		return publishLock.read(date);
 	}
 
 	/**
 	 * @brief Get the time (hour, minute, second, centisecond)
 	 */
 	TinyGPSTime getTime() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return time;
-	    }
-	    return time;
+		return publishLock.read(time);
 	}
 
 	/**
 	 * @brief Get the speed
 	 */
 	TinyGPSSpeed getSpeed() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return speed;
-	    }
-	    return speed;
+		return publishLock.read(speed);
 	}
 
 	/**
 	 * @brief Get the course
 	 */
 	TinyGPSCourse getCourse() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return course;
-	    }
-	    return course;
+		return publishLock.read(course);
 	}
 
 	/**
 	 * @brief Get the altitude
 	 */
 	TinyGPSAltitude getAltitude() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return altitude;
-	    }
-	    return altitude;
+		return publishLock.read(altitude);
 	}
 
 	/**
@@ -726,20 +1030,14 @@ public:
 	 * Geoid separation is difference between ellipsoid and mean sea level (in meters)
 	 */
 	TinyGPSAltitude getGeoidSeparation() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return geoidSeparation;
-	    }
-	    return geoidSeparation;
+		return publishLock.read(geoidSeparation);
 	}
 
 	/**
 	 * @brief Get the number of satellites
 	 */
 	TinyGPSInteger getSatellites() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return satellites;
-	    }
-	    return satellites;
+		return publishLock.read(satellites);
 	}
 
 	/**
@@ -750,23 +1048,57 @@ public:
      * The smaller the DOP number, the better the geometry.
 	 */
 	TinyGPSDecimal getHDOP() const {
-	    SINGLE_THREADED_BLOCK() {
-	    	return hdop;
-	    }
-	    return hdop;
+		return publishLock.read(hdop);
 	}
 
 	/**
-	 * @brief Copy the data in this object to another object, atomically
+	 * @brief Get the PDOP
+	 *
+	 * PDOP: Position (3D) dilution of precision. This is only valid when the data comes from UBX-NAV-PVT
+	 * (TinyGPSPlus::encodeNavSolution()), which does not have HDOP, so getHDOP() keeps the value from GGA.
+	 */
+	TinyGPSDecimal getPDOP() const {
+		return publishLock.read(pdop);
+	}
+
+	/**
+	 * @brief Get the accuracy estimates
 	 *
-	 * This is different than operator= because it uses a SINGLE_THREADED_BLOCK.
+	 * These are only valid when the data comes from UBX-NAV-PVT (TinyGPSPlus::encodeNavSolution()).
 	 */
-	void copyDataTo(TinyGPSData &other) const{
-	    SINGLE_THREADED_BLOCK() {
-	    	other.operator=(*this);
-	    }
+	TinyGPSAccuracy getAccuracy() const {
+		return publishLock.read(accuracy);
 	}
 
+	/**
+	 * @brief Copy the data in this object to another object, atomically
+	 *
+	 * This is different than operator= because the copy is retried if the data is updated
+	 * by the parser while it's being copied.
+	 */
+	void copyDataTo(TinyGPSData &other) const {
+		uint32_t start;
+		do {
+			start = publishLock.readBegin();
+			other.operator=(*this);
+		} while(publishLock.readRetry(start));
+	}
+
+	/**
+	 * @brief Copy the fix data into a FixSnapshot, atomically
+	 *
+	 * This only copies the raw values under the sequence counter; the conversions to fixed point,
+	 * age and UTC epoch are done afterwards. Use this instead of several getLocation(), getTime(),
+	 * etc. calls when you need more than one value.
+	 */
+	void copyFixSnapshotTo(FixSnapshot &snap) const;
+
+protected:
+	/**
+	 * @brief Sequence counter for publishing a new version of the data to the accessors
+	 */
+	TinyGPSSeqLock publishLock;
+
 };
 
 /**
@@ -793,6 +1125,32 @@ public:
 	 */
 	bool encode(char c);
 
+	/**
+	 * @brief Encode a block of data from the GPS
+	 *
+	 * @param buf Pointer to the data read from serial or I2C
+	 *
+	 * @param len Number of bytes in buf
+	 *
+	 * This produces the same result as calling encode(char) for each byte, but runs of ordinary
+	 * characters between delimiters are scanned a 32-bit word at a time and copied into the term
+	 * buffer at once. Only the delimiters go through the per-character state machine.
+	 *
+	 * Returns the number of sentences that were completed (passed checksum) in this block
+	 */
+	size_t encode(const char *buf, size_t len);
+
+	/**
+	 * @brief Stores a navigation solution decoded from a binary message and publishes it
+	 *
+	 * @param sol The solution, typically from Ublox::decodeNavPVT()
+	 *
+	 * This fills in the same fields as RMC and GGA, plus the accuracy estimates, and publishes them
+	 * immediately as one epoch. The publish callback is called with TinyGPSSentenceType::NAV_PVT.
+	 * It must be called from the same thread as encode().
+	 */
+	void encodeNavSolution(const TinyGPSNavSolution &sol);
+
 	/**
 	 * @brief operator<< can be used instead of encode
 	 */
@@ -848,6 +1206,114 @@ public:
 	 */
 	uint32_t passedChecksum()   const { return passedChecksumCount; }
 
+	/**
+	 * @brief Return the number of sentences with a valid checksum that were skipped because
+	 * their type is not in the sentence mask. These are not included in passedChecksum().
+	 */
+	uint32_t skippedSentences() const { return skippedSentenceCount; }
+
+	/**
+	 * @brief Returns the sentence mask bit for a sentence type, for use with setSentenceMask()
+	 */
+	static uint32_t sentenceBit(TinyGPSSentenceType type) { return 1UL << (uint8_t)type; }
+
+	/**
+	 * @brief Sets which sentence types are parsed
+	 *
+	 * @param mask A bitwise OR of sentenceBit() values, or SENTENCE_MASK_ALL (the default)
+	 *
+	 * Sentences whose type is not in the mask are skipped until the next '$'. Only their checksum
+	 * is checked, which is counted in skippedSentences() or failedChecksum(). Sentences that have
+	 * TinyGPSCustom fields are always parsed. Unrecognized sentences are TinyGPSSentenceType::OTHER.
+	 *
+	 * This is typically set once at startup, for example to only parse RMC and GGA:
+	 *
+	 * gps.setSentenceMask(TinyGPSPlus::sentenceBit(TinyGPSSentenceType::RMC) | TinyGPSPlus::sentenceBit(TinyGPSSentenceType::GGA));
+	 */
+	void setSentenceMask(uint32_t mask) { sentenceMask = mask; }
+
+	/**
+	 * @brief Gets the sentence mask set by setSentenceMask()
+	 */
+	uint32_t getSentenceMask() const { return sentenceMask; }
+
+	/**
+	 * @brief Sentence mask to parse all sentence types
+	 */
+	static const uint32_t SENTENCE_MASK_ALL = 0xffffffff;
+
+	/**
+	 * @brief Sets a function to call each time new fix data is published
+	 *
+	 * @param fn The function to call, or 0 to remove it. The sentence type is the sentence that
+	 * caused the data to be published (RMC or GGA). With setEpochSentences() this is called once
+	 * per epoch and the sentence type is the last sentence of the epoch.
+	 *
+	 * The function is called from encode(), on the thread that is parsing, after the data has been
+	 * published. Reading the data from it will not need to retry. It should return quickly.
+	 */
+	void setPublishCallback(std::function<void(TinyGPSSentenceType sentenceType)> fn) { publishCallback = fn; }
+
+	/**
+	 * @brief Sets which sentences make up one epoch (one fix)
+	 *
+	 * @param mask A bitwise OR of sentenceBit() values, typically RMC and GGA. The default, 0,
+	 * publishes the data after every RMC and every GGA sentence. Sentences excluded by
+	 * setSentenceMask() are not waited for.
+	 *
+	 * @param timeoutMs If the rest of the sentences for an epoch do not arrive within this many
+	 * milliseconds, the data that has arrived is published anyway.
+	 *
+	 * When set, the data from sentences with the same UTC time is merged and published once, after
+	 * the last sentence in the mask arrives. Readers and the publish callback then always see the
+	 * location, altitude, satellites, etc. from the same epoch. A sentence with a different time
+	 * publishes what was collected for the previous epoch first.
+	 *
+	 * This can be called from a thread other than the one calling encode().
+	 */
+	void setEpochSentences(uint32_t mask, uint32_t timeoutMs = EPOCH_TIMEOUT_MS) { epochSentenceMask = mask; epochTimeoutMs = timeoutMs; }
+
+	/**
+	 * @brief Changes only the timeout set by setEpochSentences()
+	 *
+	 * @param timeoutMs Milliseconds to wait for the rest of the sentences of an epoch
+	 *
+	 * This can be called from a thread other than the one calling encode().
+	 */
+	void setEpochTimeout(uint32_t timeoutMs) { epochTimeoutMs = timeoutMs; }
+
+	/**
+	 * @brief Gets the sentence mask set by setEpochSentences()
+	 */
+	uint32_t getEpochSentences() const { return epochSentenceMask; }
+
+	/**
+	 * @brief Publishes a partial epoch if the epoch timeout has passed
+	 *
+	 * This is checked at the start of each sentence, but if the GPS stops sending data you should
+	 * also call this periodically. Returns true if the data was published.
+	 */
+	bool checkEpochTimeout();
+
+	/**
+	 * @brief Default timeout for setEpochSentences() in milliseconds
+	 */
+	static const uint32_t EPOCH_TIMEOUT_MS = 500;
+
+	/**
+	 * @brief Returns the talker ID of the current sentence
+	 *
+	 * After encode() returns true, this is the talker of the sentence that just passed checksum.
+	 */
+	TinyGPSTalker talker()      const { return curTalker; }
+
+	/**
+	 * @brief Returns the type of the current sentence (RMC, GGA, GSV, etc.)
+	 *
+	 * After encode() returns true, this is the type of the sentence that just passed checksum.
+	 */
+	TinyGPSSentenceType sentenceType() const { return curFormatter; }
+
 private:
 	enum {GPS_SENTENCE_GPGGA, GPS_SENTENCE_GPRMC, GPS_SENTENCE_OTHER};
 
@@ -860,25 +1326,58 @@ private:
 	bool isChecksumTerm;
 	char term[_GPS_MAX_FIELD_SIZE];
 	uint8_t curSentenceType;
+	TinyGPSTalker curTalker;
+	TinyGPSSentenceType curFormatter;
 	uint8_t curTermNumber;
 	uint8_t curTermOffset;
 	bool sentenceHasFix;
+	bool skipSentence;
+	uint32_t sentenceMask;
+
+	// numeric value of the current term, accumulated as the characters arrive
+	uint32_t termInteger;
+	uint32_t termFraction;
+	uint8_t termFractionDigits;
+	uint8_t termNumberState;
+	bool termNegative;
 
 	// custom element support
 	friend class TinyGPSCustom;
-	TinyGPSCustom *customElts;
+	TinyGPSCustom *customIndex[(uint8_t)TinyGPSSentenceType::OTHER + 1]; // one bucket per formatter, plus OTHER
 	TinyGPSCustom *customCandidates;
+	TinyGPSCustom *customCursor;
 	void insertCustom(TinyGPSCustom *pElt, const char *sentenceName, int index);
+	TinyGPSCustom **customBucket(TinyGPSSentenceType formatter) { return &customIndex[(uint8_t)formatter]; }
+	static bool customMatches(const TinyGPSCustom *custom, TinyGPSTalker talker, const char *sentenceName);
+	static void parseSentenceName(const char *name, size_t len, TinyGPSTalker &talker, TinyGPSSentenceType &formatter);
 
 	// statistics
 	uint32_t encodedCharCount;
 	uint32_t sentencesWithFixCount;
 	uint32_t failedChecksumCount;
 	uint32_t passedChecksumCount;
+	uint32_t skippedSentenceCount;
+
+	std::function<void(TinyGPSSentenceType sentenceType)> publishCallback;
+
+	// epoch coalescing (the mask and timeout can be set from any thread)
+	std::atomic<uint32_t> epochSentenceMask;
+	uint32_t epochSentencesSeen;
+	uint32_t epochStartTime;
+	std::atomic<uint32_t> epochTimeoutMs;
+	TinyGPSSentenceType epochSentenceType;
 
 	// internal utilities
 	int fromHex(char a);
 	bool endOfTermHandler();
+	void appendTerm(const char *run, size_t len, uint8_t runParity);
+	void identifySentence();
+	void publish(TinyGPSSentenceType sentenceType);
+	void endOfEpochSentence();
+	void resetNumber();
+	void accumulateNumber(char c);
+	int32_t termDecimal() const;
+	void termDegrees(RawDegrees &deg) const;
 };
 
 #endif // def(__TinyGPSPlus_h)
@@ -97,6 +97,11 @@ bool UbloxCommandBase::decode(char ch) {
 		break;
 
 	case State::LOOKING_FOR_MESSAGE:
+		if (bufferOffset >= bufferSize) {
+			// Data retained by discardToNextSync1 can already fill the buffer
+			discardToNextSync1();
+			break;
+		}
 		buffer[bufferOffset++] = (uint8_t) ch;
 
 		if (bufferOffset >= (payloadLen + HEADER_PLUS_CRC_LEN)) {
@@ -125,6 +130,8 @@ bool UbloxCommandBase::decode(char ch) {
 			}
 #endif // UBLOX_DEBUG_VERBOSE_ENABLE
 
+			Ublox::getInstance()->callImmediateHandlers(this);
+
 			if (Ublox::getInstance()->hasHandler(this)) {
 				// Got a valid message with a handler, call registered message handlers
 				// from the loop thread. This requires copying the data from this message.
@@ -144,6 +151,38 @@ bool UbloxCommandBase::decode(char ch) {
 	return false;
 }
 
+void UbloxCommandBase::decode(const uint8_t *buf, size_t len) {
+	const uint8_t *end = buf + len;
+
+	while(buf < end) {
+		if (state == State::LOOKING_FOR_START) {
+			buf = (const uint8_t *) memchr(buf, SYNC_1, end - buf);
+			if (!buf) {
+				break;
+			}
+		}
+		else if (state == State::LOOKING_FOR_MESSAGE) {
+			// Copy all but the last byte of the message, which goes through decode(char) to complete it.
+			// Never copy past the end of buffer, even if payloadLen and bufferOffset disagree.
+			size_t messageEnd = payloadLen + HEADER_PLUS_CRC_LEN - 1;
+			if (messageEnd > bufferSize - 1) {
+				messageEnd = bufferSize - 1;
+			}
+			size_t count = (bufferOffset < messageEnd) ? (messageEnd - bufferOffset) : 0;
+			if (count > (size_t)(end - buf)) {
+				count = end - buf;
+			}
+			memcpy(&buffer[bufferOffset], buf, count);
+			bufferOffset += count;
+			buf += count;
+			if (buf == end) {
+				break;
+			}
+		}
+		decode((char) *buf++);
+	}
+}
+
 void UbloxCommandBase::updateChecksum() {
 	buffer[0] = SYNC_1;
 	buffer[1] = SYNC_2;
@@ -258,7 +297,8 @@ void UbloxCommandBase::discardToNextSync1() {
 			// Found a 0xb5, move that to the beginning of the buffer
 			memmove(buffer, &buffer[ii], bufferOffset - ii);
 			bufferOffset -= ii;
-			state = State::LOOKING_FOR_MESSAGE;
+			// The header after the new SYNC_1 has not been validated yet
+			state = State::LOOKING_FOR_LENGTH;
 			return;
 		}
 	}
@@ -268,50 +308,525 @@ void UbloxCommandBase::discardToNextSync1() {
 }
 
 UbloxCommandBase *UbloxCommandBase::clone() {
-	UbloxCommandBase *copy = new UbloxCommandBase(bufferSize);
-	if (copy) {
-		if (copy->buffer) {
-			memcpy(copy->buffer, buffer, bufferSize);
-			copy->bufferOffset = bufferOffset;
-			copy->payloadLen = payloadLen;
-			copy->state = state;
-			return copy;
+	size_t frameLen = payloadLen + HEADER_PLUS_CRC_LEN;
+
+	UbloxCommandBase *copy = UbloxMessagePool::getInstance().allocate(frameLen);
+	if (!copy) {
+		copy = new UbloxCommandBase(frameLen);
+		if (!copy) {
+			return NULL;
 		}
-		else {
+		if (!copy->buffer) {
 			delete copy;
 			return NULL;
 		}
 	}
+
+	memcpy(copy->buffer, buffer, frameLen);
+	copy->bufferOffset = bufferOffset;
+	copy->payloadLen = payloadLen;
+	copy->state = state;
+	return copy;
+}
+
+// [static]
+void UbloxCommandBase::deleteClone(UbloxCommandBase *cmd) {
+	if (!UbloxMessagePool::getInstance().release(cmd)) {
+		delete cmd;
+	}
+}
+
+//
+// UbloxMessagePool
+//
+
+// Size of the UbloxCommandBase object at the start of each block, rounded up so the message is aligned
+static const size_t POOL_OBJECT_SIZE = (sizeof(UbloxCommandBase) + 7) & ~7;
+
+// Largest message (HEADER_PLUS_CRC_LEN + payload) and number of blocks in each size class
+// 400 bytes is NAV-SAT with up to 32 satellites and the MGA messages
+static constexpr size_t POOL_FRAME_SIZE[UbloxMessagePool::NUM_SIZE_CLASSES] = { 32, 64, 128, 400, UbloxMessagePool::MAX_FRAME_SIZE };
+static constexpr size_t POOL_BLOCK_COUNT[UbloxMessagePool::NUM_SIZE_CLASSES] = { 8, 8, 4, 4, 1 };
+static_assert(UbloxMessagePool::MAX_FRAME_SIZE == UbloxNmeaDemux::UBX_MAX_PAYLOAD + 8, "MAX_FRAME_SIZE must hold the largest UBX message");
+
+// Offset of the first block of size class ii in poolStorage. All of the size classes are in one array
+// so the block counts are only in POOL_BLOCK_COUNT. The frame sizes are multiples of 8, so every block
+// stays aligned.
+static constexpr size_t poolOffset(size_t ii) {
+	return (ii == 0) ? 0 : poolOffset(ii - 1) + POOL_BLOCK_COUNT[ii - 1] * (POOL_OBJECT_SIZE + POOL_FRAME_SIZE[ii - 1]);
+}
+
+// freeMask has one bit per block
+static constexpr bool poolBlockCountsFit(size_t ii) {
+	return (ii == UbloxMessagePool::NUM_SIZE_CLASSES) || (POOL_BLOCK_COUNT[ii] <= 32 && poolBlockCountsFit(ii + 1));
+}
+static_assert(poolBlockCountsFit(0), "POOL_BLOCK_COUNT must be 32 or less");
+
+alignas(8) static uint8_t poolStorage[poolOffset(UbloxMessagePool::NUM_SIZE_CLASSES)];
+
+UbloxMessagePool::UbloxMessagePool() {
+	for(size_t ii = 0; ii < NUM_SIZE_CLASSES; ii++) {
+		freeMask[ii].store((1UL << POOL_BLOCK_COUNT[ii]) - 1);
+	}
+}
+
+// [static]
+UbloxMessagePool &UbloxMessagePool::getInstance() {
+	static UbloxMessagePool instance;
+	return instance;
+}
+
+UbloxCommandBase *UbloxMessagePool::allocate(size_t frameLen) {
+	if (frameLen > MAX_FRAME_SIZE) {
+		oversize++;
+		return NULL;
+	}
+
+	for(size_t ii = 0; ii < NUM_SIZE_CLASSES; ii++) {
+		if (frameLen > POOL_FRAME_SIZE[ii]) {
+			continue;
+		}
+
+		// Claim the lowest free block in this size class, or try the next larger class if it's full
+		uint32_t mask = freeMask[ii].load();
+		while(mask != 0) {
+			uint32_t bit = mask & (~mask + 1);
+			if (freeMask[ii].compare_exchange_weak(mask, mask & ~bit)) {
+				size_t index = 0;
+				while((bit >> index) != 1) {
+					index++;
+				}
+				allocations++;
+
+				uint8_t inUse = (uint8_t) (POOL_BLOCK_COUNT[ii] - __builtin_popcount(mask & ~bit));
+				if (inUse > highWater[ii]) {
+					highWater[ii] = inUse;
+				}
+
+				uint8_t *block = &poolStorage[poolOffset(ii) + index * (POOL_OBJECT_SIZE + POOL_FRAME_SIZE[ii])];
+				return new(block) UbloxCommandBase(block + POOL_OBJECT_SIZE, POOL_FRAME_SIZE[ii]);
+			}
+		}
+	}
+	exhausted++;
+	return NULL;
+}
+
+bool UbloxMessagePool::release(UbloxCommandBase *cmd) {
+	uint8_t *block = (uint8_t *)cmd;
+
+	for(size_t ii = 0; ii < NUM_SIZE_CLASSES; ii++) {
+		size_t blockSize = POOL_OBJECT_SIZE + POOL_FRAME_SIZE[ii];
+
+		uint8_t *start = &poolStorage[poolOffset(ii)];
+
+		if (block >= start && block < start + POOL_BLOCK_COUNT[ii] * blockSize) {
+			size_t index = (block - start) / blockSize;
+
+			cmd->~UbloxCommandBase();
+			freeMask[ii].fetch_or(1UL << index);
+			return true;
+		}
+	}
+	return false;
+}
+
+UbloxMessagePoolStats UbloxMessagePool::getStats() const {
+	UbloxMessagePoolStats result;
+
+	result.allocations = allocations;
+	result.exhausted = exhausted;
+	result.oversize = oversize;
+	for(size_t ii = 0; ii < NUM_SIZE_CLASSES; ii++) {
+		result.inUse[ii] = (uint8_t) (POOL_BLOCK_COUNT[ii] - __builtin_popcount(freeMask[ii].load()));
+		result.highWater[ii] = highWater[ii];
+	}
+	return result;
+}
+
+//
+// UbloxMessageQueue
+//
+
+UbloxMessageQueue::UbloxMessageQueue() : head(0), tail(0), stats() {
+}
+
+bool UbloxMessageQueue::push(UbloxCommandBase *cmd) {
+	uint32_t curTail = tail.load(std::memory_order_relaxed);
+	uint32_t used = curTail - head.load(std::memory_order_acquire);
+
+	if (used >= CAPACITY) {
+		stats.dropped++;
+		return false;
+	}
+
+	entries[curTail & (CAPACITY - 1)] = cmd;
+	tail.store(curTail + 1, std::memory_order_release);
+
+	stats.pushed++;
+	if (used + 1 > stats.highWater) {
+		stats.highWater = (uint8_t) (used + 1);
+	}
+	return true;
+}
+
+UbloxCommandBase *UbloxMessageQueue::pop() {
+	uint32_t curHead = head.load(std::memory_order_relaxed);
+
+	if (curHead == tail.load(std::memory_order_acquire)) {
+		return NULL;
+	}
+
+	UbloxCommandBase *cmd = entries[curHead & (CAPACITY - 1)];
+	head.store(curHead + 1, std::memory_order_release);
+	return cmd;
+}
+
+//
+// UbloxHandlerIndex
+//
+
+void UbloxHandlerIndex::add(UbloxMessageHandler *handler) {
+	if (handler->classFilter == UbloxCommandBase::CLASS_UBX_ACK) {
+		byAckOrig[makeKey(handler->origClassId, handler->origMsgId)].push_back(handler);
+	}
+	else
+	if (handler->classFilter == 0xff) {
+		anyClass.push_back(handler);
+	}
 	else {
+		byClassId[makeKey(handler->classFilter, handler->idFilter)].push_back(handler);
+	}
+}
+
+bool UbloxHandlerIndex::remove(UbloxMessageHandler *handler) {
+	std::unordered_map<uint16_t, std::vector<UbloxMessageHandler*>> *map;
+	uint16_t key;
+
+	if (handler->classFilter == UbloxCommandBase::CLASS_UBX_ACK) {
+		map = &byAckOrig;
+		key = makeKey(handler->origClassId, handler->origMsgId);
+	}
+	else
+	if (handler->classFilter == 0xff) {
+		size_t oldSize = anyClass.size();
+		removeFromBucket(anyClass, handler);
+		return anyClass.size() != oldSize;
+	}
+	else {
+		map = &byClassId;
+		key = makeKey(handler->classFilter, handler->idFilter);
+	}
+
+	auto it = map->find(key);
+	if (it == map->end()) {
+		return false;
+	}
+
+	// The bucket is kept even if it's now empty, so adding the next handler for this key does not allocate
+	size_t oldSize = it->second.size();
+	removeFromBucket(it->second, handler);
+	return it->second.size() != oldSize;
+}
+
+bool UbloxHandlerIndex::hasMatch(const UbloxCommandBase *cmd) const {
+	if (!anyClass.empty()) {
+		return true;
+	}
+
+	if (cmd->getMsgClass() == UbloxCommandBase::CLASS_UBX_ACK) {
+		return hasHandlers(byAckOrig, makeKey(cmd->getU1(0), cmd->getU1(1)));
+	}
+
+	return hasHandlers(byClassId, makeKey(cmd->getMsgClass(), cmd->getMsgId())) ||
+		hasHandlers(byClassId, makeKey(cmd->getMsgClass(), UbloxCommandBase::MSG_UBX_ANY));
+}
+
+// [static]
+bool UbloxHandlerIndex::hasHandlers(const std::unordered_map<uint16_t, std::vector<UbloxMessageHandler*>> &map, uint16_t key) {
+	auto it = map.find(key);
+	return it != map.end() && !it->second.empty();
+}
+
+void UbloxHandlerIndex::findMatches(const UbloxCommandBase *cmd, std::vector<UbloxMessageHandler*> &matches) const {
+	forEachMatch(cmd, [&matches](UbloxMessageHandler *handler) {
+		matches.push_back(handler);
+	});
+}
+
+// [static]
+void UbloxHandlerIndex::removeFromBucket(std::vector<UbloxMessageHandler*> &bucket, UbloxMessageHandler *handler) {
+	for(auto it = bucket.begin(); it != bucket.end(); it++) {
+		if (*it == handler) {
+			bucket.erase(it);
+			break;
+		}
+	}
+}
+
+//
+// UbloxHandlerTimers
+//
+
+void UbloxHandlerTimers::add(UbloxMessageHandler *handler) {
+	if (handler->timeout == 0) {
+		return;
+	}
+
+	Entry entry;
+	entry.deadline = handler->timeout;
+	entry.handler = handler;
+
+	heap.push_back(entry);
+	std::push_heap(heap.begin(), heap.end(), laterDeadline);
+}
+
+void UbloxHandlerTimers::remove(UbloxMessageHandler *handler) {
+	if (handler->timeout == 0) {
+		return;
+	}
+
+	// There are only a few timeouts waiting at once, so a linear search is fine
+	for(auto it = heap.begin(); it != heap.end(); it++) {
+		if (it->handler == handler) {
+			*it = heap.back();
+			heap.pop_back();
+			std::make_heap(heap.begin(), heap.end(), laterDeadline);
+			break;
+		}
+	}
+}
+
+UbloxMessageHandler *UbloxHandlerTimers::popExpired(uint64_t now) {
+	if (heap.empty() || !isExpired(heap.front().deadline, now)) {
 		return NULL;
 	}
+
+	UbloxMessageHandler *handler = heap.front().handler;
+
+	std::pop_heap(heap.begin(), heap.end(), laterDeadline);
+	heap.pop_back();
+
+	return handler;
 }
 
 //
 // UbloxSyncCommand
 //
 
-UbloxSyncCommand::UbloxSyncCommand() {
-	// Create and lock the mutex
-	os_mutex_create(&mutex);
-	os_mutex_lock(mutex);
+UbloxSyncCommand::UbloxSyncCommand() : state(std::make_shared<State>()) {
 }
 
 UbloxSyncCommand::~UbloxSyncCommand() {
-	os_mutex_destroy(mutex);
 }
 
 void UbloxSyncCommand::completion(UbloxMessageHandler::Reason reason) {
+	state->completion(reason);
+}
+
+UbloxCommandCallback UbloxSyncCommand::callback() {
+	std::shared_ptr<State> state = this->state;
+
+	return [state](UbloxCommandBase *, UbloxMessageHandler::Reason reason) {
+		state->completion(reason);
+	};
+}
+
+bool UbloxSyncCommand::canBlock() {
+	// The response would be decoded by this thread once the handler returns. Waiting would block
+	// until the deadline, and pumping updateGPS would decode over the message the handler has.
+	Ublox *ublox = Ublox::getInstance();
+	return !ublox || !ublox->isImmediateHandlerThread();
+}
+
+UbloxMessageHandler::Reason UbloxSyncCommand::blockUntilCompletion(unsigned long timeout) {
+	unsigned long waitMs = timeout + DEADLINE_MARGIN_MS;
+	Ublox *ublox = Ublox::getInstance();
+
+	if (!canBlock()) {
+		UBLOX_DEBUG(("sync command called from an immediate handler"));
+		return UbloxMessageHandler::Reason::TIMEOUT;
+	}
+
+	if (ublox && ublox->isHandlerThread()) {
+		// Completion only happens from callHandlers, so waiting here would deadlock. Run it instead.
+		AssetTrackerBase *tracker = AssetTrackerBase::getInstance();
+		unsigned long start = millis();
+
+		while(!state->done.load() && millis() - start < waitMs) {
+			if (tracker && !tracker->isThreadedMode()) {
+				tracker->updateGPS();
+			}
+			ublox->callHandlers();
+			if (!state->done.load()) {
+				delay(1);
+			}
+		}
+	}
+	else {
+		os_semaphore_take(state->semaphore, waitMs, false);
+	}
+
+	if (!state->done.load()) {
+		UBLOX_DEBUG(("sync command did not complete in %lu ms", waitMs));
+		return UbloxMessageHandler::Reason::TIMEOUT;
+	}
+	return state->reason;
+}
+
+UbloxSyncCommand::State::State() : done(false) {
+	os_semaphore_create(&semaphore, 1, 0);
+}
+
+UbloxSyncCommand::State::~State() {
+	os_semaphore_destroy(semaphore);
+}
+
+void UbloxSyncCommand::State::completion(UbloxMessageHandler::Reason reason) {
+	if (done.load()) {
+		return;
+	}
 	this->reason = reason;
-	os_mutex_unlock(mutex);
+	done.store(true);
+	os_semaphore_give(semaphore, false);
+}
+
+
+bool UbloxNmeaDemux::decode(const uint8_t *buf, size_t len) {
+	static const uint8_t ubxSync[2] = { 0xb5, 0x62 };
+	bool hasSentence = false;
+	const uint8_t *end = buf + len;
+
+	while(buf < end) {
+		switch(state) {
+		case State::IDLE: {
+			// Skip to the next frame start
+			const uint8_t *start = buf;
+			while(buf < end && *buf != '$' && *buf != ubxSync[0]) {
+				buf++;
+			}
+			stats.discardedBytes += (buf - start);
+			if (buf < end) {
+				if (*buf == '$') {
+					state = State::NMEA;
+					offset = 0;
+				}
+				else {
+					state = State::UBX_SYNC;
+					buf++;
+				}
+			}
+			break;
+		}
+
+		case State::UBX_SYNC:
+			if (*buf == ubxSync[1]) {
+				// The first sync byte may have been in the previous block
+				decodeUbx(ubxSync, sizeof(ubxSync));
+				buf++;
+				state = State::UBX_HEADER;
+				offset = 0;
+			}
+			else {
+				// Look at this byte again as a possible frame start
+				stats.discardedBytes++;
+				stats.framingErrors++;
+				state = State::IDLE;
+			}
+			break;
+
+		case State::UBX_HEADER: {
+			// Class, ID, and the 2 byte little endian payload length
+			const uint8_t *start = buf;
+			while(buf < end && offset < 4) {
+				if (offset == 2) {
+					payloadLen = *buf;
+				}
+				else if (offset == 3) {
+					payloadLen |= (uint16_t)*buf << 8;
+				}
+				buf++;
+				offset++;
+			}
+			decodeUbx(start, buf - start);
+
+			if (offset == 4) {
+				if (payloadLen > UBX_MAX_PAYLOAD) {
+					// Probably not really a UBX frame. The UBX decoder discards it too.
+					stats.framingErrors++;
+					state = State::IDLE;
+				}
+				else {
+					remaining = payloadLen + 2; // payload and checksum
+					state = State::UBX_BODY;
+				}
+			}
+			break;
+		}
+
+		case State::UBX_BODY: {
+			size_t count = end - buf;
+			if (count > remaining) {
+				count = remaining;
+			}
+			decodeUbx(buf, count);
+			buf += count;
+			remaining -= count;
+			if (remaining == 0) {
+				state = State::IDLE;
+			}
+			break;
+		}
+
+		case State::NMEA: {
+			// NMEA is 7-bit ASCII, so any byte with the high bit set (like 0xB5) ends the sentence
+			const uint8_t *start = buf;
+			bool complete = false;
+			bool cutOff = false;
+			while(buf < end) {
+				uint8_t c = *buf;
+				if (c & 0x80) {
+					cutOff = true;
+					break;
+				}
+				buf++;
+				if (c == '\n') {
+					complete = true;
+					break;
+				}
+				if (++offset > NMEA_MAX_LEN) {
+					cutOff = true;
+					break;
+				}
+			}
+			hasSentence |= decodeNmea(start, buf - start);
+
+			if (complete || cutOff) {
+				if (cutOff) {
+					stats.framingErrors++;
+				}
+				state = State::IDLE;
+			}
+			break;
+		}
+		}
+	}
+
+	return hasSentence;
 }
 
-UbloxMessageHandler::Reason UbloxSyncCommand::blockUntilCompletion() {
-	// This will block until the callback is called
-	os_mutex_lock(mutex);
+bool UbloxNmeaDemux::decodeNmea(const uint8_t *buf, size_t len) {
+	stats.nmeaBytes += len;
+	return nmeaDecoder && len > 0 && nmeaDecoder(buf, len);
+}
 
-	return this->reason;
+void UbloxNmeaDemux::decodeUbx(const uint8_t *buf, size_t len) {
+	stats.ubxBytes += len;
+	if (ubxDecoder && len > 0) {
+		ubxDecoder(buf, len);
+	}
 }
+
 //
 //
 //
@@ -319,169 +834,451 @@ UbloxMessageHandler::Reason UbloxSyncCommand::blockUntilCompletion() {
 Ublox *Ublox::instance = 0;
 
 
-Ublox::Ublox() {	
+Ublox::Ublox() : handlerInbox(NULL), nextToken(1) {	
 	instance = this;
+
+	removalInbox.store(NULL);
+	registeredHandlers.store(NULL);
+	for(size_t ii = 0; ii < PENDING_CLASS_SLOTS; ii++) {
+		pendingByClass[ii].store(0);
+	}
+	publishedHandlers.store(NULL);
+	handlerReaders.store(0);
+	immediateCallThread.store(0);
 }
 
 Ublox::~Ublox() {
+	delete publishedHandlers.load();
+	for(auto it = retiredSnapshots.begin(); it != retiredSnapshots.end(); it++) {
+		delete *it;
+	}
+	for(auto it = spareSnapshots.begin(); it != spareSnapshots.end(); it++) {
+		delete *it;
+	}
 }
 
 void Ublox::setup() {
-	AssetTrackerBase::getInstance()->setExternalDecoder([this](char ch) {
-		return incomingCommand.decode(ch);
+	handlerThread = os_thread_current(NULL);
+
+	AssetTrackerBase::getInstance()->setExternalBlockDecoder([this](const uint8_t *buf, size_t len) {
+		incomingCommand.decode(buf, len);
 	});
+
+	if (setupBaud != 0) {
+		// The CFG-PRT poll from setUbxOnly() would be lost while the rate is changing, so the
+		// messages are configured once the GPS is at the new rate (or back at the old one)
+		setBaudRate(setupBaud, [this](UbloxCommandBase *, UbloxMessageHandler::Reason reason) {
+			UBLOX_DEBUG(("setBaudRate %lu reason=%d", (unsigned long) setupBaud, (int) reason));
+			setupMessages();
+		});
+	}
+	else {
+		setupMessages();
+	}
+}
+
+void Ublox::setupMessages() {
+	if (ubxOnly) {
+		setUbxOnly(true, [](UbloxCommandBase *, UbloxMessageHandler::Reason reason) {
+			UBLOX_DEBUG(("setUbxOnly reason=%d", (int) reason));
+		});
+	}
+	else if (navPvt) {
+		addNavPVTHandler();
+		setMessageRate(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_PVT, 1);
+	}
 }
 
 void Ublox::loop() {
 	callHandlers();	
 }
 
+bool Ublox::isHandlerThread() const {
+	return handlerThread != 0 && os_thread_is_current(handlerThread);
+}
 
-void Ublox::addHandler(UbloxMessageHandler *handler) {
-	// TODO: Probably add a mutex here
-	handlersToAdd.push_back(handler);
+bool Ublox::isImmediateHandlerThread() const {
+	os_thread_t thread = immediateCallThread.load();
+	return thread != 0 && os_thread_is_current(thread);
 }
 
-#if 0
-void Ublox::removeHandler(UbloxMessageHandler *handler) {
 
-	auto it = handlers.begin();
+UbloxHandlerToken Ublox::addHandler(UbloxMessageHandler *handler) {
+	UbloxHandlerToken token;
+	do {
+		token = nextToken.fetch_add(1);
+	} while(token == 0);
+	handler->token = token;
+	handler->removed.store(false);
+	handler->registered = false;
 
-	while(it != handlers.end()) {
-		if (*it == handler) {
-			it = handlers.erase(it);
+	if (!handler->immediate) {
+		// Counted until it's in handlerIndex, so hasHandler() keeps messages it may be waiting for
+		pendingByClass[pendingSlot(handler->classFilter)].fetch_add(1);
+	}
+
+	// Push onto the inbox. loop() takes the whole list at once, so there's no ABA problem.
+	UbloxMessageHandler *head = handlerInbox.load();
+	do {
+		handler->nextPending = head;
+	} while(!handlerInbox.compare_exchange_weak(head, handler));
+
+	// Then onto the list removeHandler searches. Only loop unlinks handlers, so pushing is safe.
+	UbloxMessageHandler *first = registeredHandlers.load();
+	do {
+		handler->nextRegistered.store(first);
+	} while(!registeredHandlers.compare_exchange_weak(first, handler));
+
+	return token;
+}
+
+bool Ublox::removeHandler(UbloxHandlerToken token) {
+	if (token == 0) {
+		return false;
+	}
+
+	// While counted as a reader, loop does not free or reuse a handler unlinked from registeredHandlers
+	handlerReaders.fetch_add(1);
+
+	UbloxMessageHandler *handler = registeredHandlers.load();
+	while(handler && handler->token != token) {
+		handler = handler->nextRegistered.load();
+	}
+	if (handler && !handler->removed.exchange(true)) {
+		// Only the call that set the flag links the handler, so it's in the list at most once
+		UbloxMessageHandler *head = removalInbox.load();
+		do {
+			handler->nextRemoval = head;
+		} while(!removalInbox.compare_exchange_weak(head, handler));
+	}
+
+	handlerReaders.fetch_sub(1);
+
+	return handler != NULL;
+}
+
+void Ublox::processHandlerInbox() {
+	// The inbox is newest first, reverse it so handlers are added in the order addHandler was called
+	UbloxMessageHandler *pending = handlerInbox.exchange(NULL);
+	UbloxMessageHandler *ordered = NULL;
+	while(pending) {
+		UbloxMessageHandler *next = pending->nextPending;
+		pending->nextPending = ordered;
+		ordered = pending;
+		pending = next;
+	}
+
+	bool unlinked = false;
+	for(UbloxMessageHandler *handler = ordered; handler; handler = handler->nextPending) {
+		if (handler->removed.load()) {
+			// Removed before it was added
+			unlinkHandler(handler);
+			unlinked = true;
+			continue;
+		}
+		handler->registered = true;
+		handlerTimers.add(handler);
+
+		if (handler->immediate) {
+			immediateHandlerIndex.add(handler);
 		}
 		else {
-			it++;
+			handlerIndex.add(handler);
+		}
+		handlersChanged = true;
+	}
+
+	// hasHandler() counts the new handlers as pending until the decoding thread can see them
+	publishHandlers();
+	if (unlinked) {
+		// removeHandler may be looking at a handler that was removed before it was added
+		waitForHandlerReaders();
+	}
+
+	while(ordered) {
+		UbloxMessageHandler *handler = ordered;
+		ordered = handler->nextPending;
+		handler->nextPending = NULL;
+
+		if (!handler->immediate) {
+			pendingByClass[pendingSlot(handler->classFilter)].fetch_sub(1);
+		}
+		if (!handler->registered && handler->removeAndDelete) {
+			deleteHandler(handler);
+		}
+	}
+
+	// Then the removals. A handler removed before loop took it from the inbox above is not registered
+	// and has been dropped there (or will be on the next call), so it's skipped here.
+	UbloxMessageHandler *removal = removalInbox.exchange(NULL);
+	while(removal) {
+		UbloxMessageHandler *handler = removal;
+		removal = handler->nextRemoval;
+		handler->nextRemoval = NULL;
+
+		if (!handler->registered) {
+			continue;
+		}
+
+		removeHandlerInternal(handler);
+		if (handler->removeAndDelete && !handler->calling) {
+			// A handler that's running is deleted by the call that's running it when it returns
+			deleteHandler(handler);
+		}
+	}
+}
+
+void Ublox::unlinkHandler(UbloxMessageHandler *handler) {
+	UbloxMessageHandler *next = handler->nextRegistered.load();
+
+	// Other threads only push onto the head, so it's the only link that can change under loop
+	UbloxMessageHandler *head = handler;
+	if (registeredHandlers.compare_exchange_strong(head, next)) {
+		return;
+	}
+
+	for(UbloxMessageHandler *prev = registeredHandlers.load(); prev; prev = prev->nextRegistered.load()) {
+		if (prev->nextRegistered.load() == handler) {
+			prev->nextRegistered.store(next);
+			return;
 		}
 	}
 }
-#endif
 
 bool Ublox::hasHandler(UbloxCommandBase *cmd) {
-	for(auto it = handlers.begin(); it != handlers.end(); ) {
-		auto handler = *it;
-		bool increment = true;
+	if (pendingByClass[pendingSlot(cmd->getMsgClass())].load() != 0 || pendingByClass[pendingSlot(0xff)].load() != 0) {
+		// A handler added since the last loop may be waiting for this message (for example, a quick
+		// ACK), so keep it. The inbox is processed before the message is dispatched.
+		return true;
+	}
+
+	// Counting the reader before loading the pointer keeps loop from reusing the snapshot until this returns
+	handlerReaders.fetch_add(1);
+	UbloxHandlerSnapshot *snapshot = publishedHandlers.load();
+	bool result = snapshot && snapshot->handlers.hasMatch(cmd);
+	handlerReaders.fetch_sub(1);
+
+	return result;
+}
+
+void Ublox::callImmediateHandlers(UbloxCommandBase *cmd) {
+	// This runs on the decoding thread and never locks. The published snapshot is not changed, and
+	// while handlerReaders is non-zero loop does not reuse it or free a handler removed from it.
+	handlerReaders.fetch_add(1);
+	if (immediateCallDepth++ == 0) {
+		immediateCallThread.store(os_thread_current(NULL));
+	}
 
-		if (handler->classFilter == 0xff || handler->classFilter == cmd->getMsgClass()) {
-			if (handler->idFilter == 0xff || handler->idFilter == cmd->getMsgId()) {
-				return true;
+	UbloxHandlerSnapshot *snapshot = publishedHandlers.load();
+	if (snapshot) {
+		snapshot->immediateHandlers.forEachMatch(cmd, [cmd](UbloxMessageHandler *handler) {
+			if (!handler->removed.load()) {
+				handler->handler(cmd, UbloxMessageHandler::Reason::DATA);
 			}
-		}
-		if (increment) {
-			it++;
-		}
+		});
 	}
-	return false;
+
+	if (--immediateCallDepth == 0) {
+		immediateCallThread.store(0);
+	}
+	handlerReaders.fetch_sub(1);
 }
 
 
 void Ublox::callHandlers() {
-	while(!commandsToHandle.empty()) {
-		UbloxCommandBase *cmd = commandsToHandle.front();
-		commandsToHandle.pop_front();
+	callHandlersDepth++;
+
+	processHandlerInbox();
+
+	// Take the spare vector, so a nested call from a *Sync method in a handler gets its own
+	std::vector<UbloxMessageHandler*> matches;
+	matches.swap(matchingHandlers);
+
+	UbloxCommandBase *cmd;
+	while((cmd = commandsToHandle.pop()) != NULL) {
 
 		UBLOX_DEBUG_VERBOSE(("handling class=%02x id=%02d", cmd->getMsgClass(), cmd->getMsgId()));
 
-		uint8_t origMsgId = 0, origMsgClass = 0;
-		if (cmd->getMsgClass() == UbloxCommandBase::CLASS_UBX_ACK) { // 0x05
-			origMsgClass = cmd->getU1(0);
-			origMsgId = cmd->getU1(1);
-		}
+		matches.clear();
+		handlerIndex.findMatches(cmd, matches);
 
-		for(auto it = handlers.begin(); it != handlers.end(); ) {
+		for(auto it = matches.begin(); it != matches.end(); it++) {
 			auto handler = *it;
-			bool increment = true;
+
+			if (handler->calling || handler->removed) {
+				// Already running further up the stack, or removed by a nested call
+				continue;
+			}
+			handler->calling = true;
 
 			if (handler->classFilter == UbloxCommandBase::CLASS_UBX_ACK) { // 0x05
-				// Handle CFG ACK/NACK
-				UBLOX_DEBUG_VERBOSE(("handling CLASS_UBX_ACK origClass=0x%02x origMsgId=0x%02x", origMsgClass, origMsgId));
-
-				if (handler->origClassId == origMsgClass &&
-					handler->origMsgId == origMsgId) {
-					// Matches original request
-					UbloxMessageHandler::Reason reason;
-
-					if (cmd->getMsgId() == UbloxCommandBase::MSG_UBX_ACK_ACK) {
-						reason = UbloxMessageHandler::Reason::ACK;
-					}
-					else {
-						reason = UbloxMessageHandler::Reason::NACK;
-					}
-					
-					UBLOX_DEBUG_VERBOSE(("%s origClass=0x%02x origMsgId=0x%02x", 
-						((reason == UbloxMessageHandler::Reason::ACK) ? "ACK" : "NACK"), 
-						handler->origMsgId, handler->origMsgId));
-
-					handler->handler(cmd, reason);
-					if (handler->removeAndDelete) {
-						it = handlers.erase(it);
-						delete handler;
-						increment = false;
-					}
+				// Handle CFG ACK/NACK, the index only returns handlers whose origClassId and origMsgId match
+				UbloxMessageHandler::Reason reason;
+
+				if (cmd->getMsgId() == UbloxCommandBase::MSG_UBX_ACK_ACK) {
+					reason = UbloxMessageHandler::Reason::ACK;
+				}
+				else {
+					reason = UbloxMessageHandler::Reason::NACK;
 				}
+				
+				UBLOX_DEBUG_VERBOSE(("%s origClass=0x%02x origMsgId=0x%02x", 
+					((reason == UbloxMessageHandler::Reason::ACK) ? "ACK" : "NACK"), 
+					handler->origClassId, handler->origMsgId));
+
+				handler->handler(cmd, reason);
 			}
 			else {
 				// Handle regular responses and data
-				if (handler->classFilter == 0xff || handler->classFilter == cmd->getMsgClass()) {
-					if (handler->idFilter == 0xff || handler->idFilter == cmd->getMsgId()) {						
-						UBLOX_DEBUG_VERBOSE(("calling handler class=0x%02x id=0x%02x", cmd->getMsgClass(), cmd->getMsgId()));
-						handler->handler(cmd, UbloxMessageHandler::Reason::DATA);
-						if (handler->removeAndDelete) {
-							it = handlers.erase(it);
-							delete handler;
-							increment = false;
-						}
-					}
-				}
+				UBLOX_DEBUG_VERBOSE(("calling handler class=0x%02x id=0x%02x", cmd->getMsgClass(), cmd->getMsgId()));
+				handler->handler(cmd, UbloxMessageHandler::Reason::DATA);
 			}
-			if (increment) {
-				it++;
+			handler->calling = false;
+
+			if (handler->removeAndDelete) {
+				removeHandlerInternal(handler);
+				deleteHandler(handler);
 			}
 		}
 
-		delete cmd;
+		UbloxCommandBase::deleteClone(cmd);
 	}
 
-	// If handlers were added, add them into the real list now. We don't do it above because it
-	// can corrupt the handlers list
-	while(!handlersToAdd.empty()) {
-		UbloxMessageHandler *handler = handlersToAdd.back();
-		handlersToAdd.pop_back();
+	matches.clear();
+	matchingHandlers.swap(matches);
+
+	// If handlers were added by the handlers above, add them now so their timeouts start
+	processHandlerInbox();
 
-		handlers.push_back(handler);
+	// Handle timeouts. Only handlers whose deadline has passed are looked at.
+	uint64_t now = System.millis();
+	UbloxMessageHandler *handler;
+	while((handler = handlerTimers.popExpired(now)) != NULL) {
+		if (handler->removed.load()) {
+			// Removed from another thread, taken out of the index on the next processHandlerInbox()
+			continue;
+		}
+		if (handler->calling) {
+			// Running further up the stack. Check again on the next call, when it has returned.
+			handler->timeout = now;
+			handlerTimers.add(handler);
+			continue;
+		}
+		if (handler->classFilter != UbloxCommandBase::CLASS_UBX_ACK) {
+			UBLOX_DEBUG_VERBOSE(("timeout classFilter=0x%02x idFilter=0x%02x", handler->classFilter, handler->idFilter));
+		}
+		else {
+			UBLOX_DEBUG_VERBOSE(("timeout ACK origClass=0x%02x origMsgId=0x%02x", handler->origClassId, handler->origMsgId));
+		}
+		handler->calling = true;
+		handler->handler(NULL, UbloxMessageHandler::Reason::TIMEOUT);
+		handler->calling = false;
+		if (handler->removeAndDelete) {
+			removeHandlerInternal(handler);
+			deleteHandler(handler);
+		}
 	}
 
-	// Handle timeouts
-	for(auto it = handlers.begin(); it != handlers.end(); ) {
-		auto handler = *it;
-		bool increment = true;
+	publishHandlers();
 
-		if (handler->timeout !=0 && System.millis() > handler->timeout) {
-			// Timeout occurred
-			if (handler->classFilter != UbloxCommandBase::CLASS_UBX_ACK) {
-				UBLOX_DEBUG_VERBOSE(("timeout classFilter=0x%02x idFilter=0x%02x", handler->classFilter, handler->idFilter));
-			}
-			else {
-				UBLOX_DEBUG_VERBOSE(("timeout ACK origClass=0x%02x origMsgId=0x%02x", handler->origMsgId, handler->origMsgId));
-			}
-			handler->handler(NULL, UbloxMessageHandler::Reason::TIMEOUT);
-			if (handler->removeAndDelete) {
-				it = handlers.erase(it);
-				delete handler;
-				increment = false;
-			}
-		}
+	if (--callHandlersDepth == 0) {
+		reclaimHandlers();
+	}
+}
 
-		if (increment) {
-			it++;
-		}
+void Ublox::deleteHandler(UbloxMessageHandler *handler) {
+	handlersToDelete.push_back(handler);
+}
+
+void Ublox::publishHandlers() {
+	if (!handlersChanged) {
+		return;
 	}
+	handlersChanged = false;
 
+	UbloxHandlerSnapshot *snapshot;
+	if (!spareSnapshots.empty()) {
+		snapshot = spareSnapshots.back();
+		spareSnapshots.pop_back();
+	}
+	else {
+		snapshot = new UbloxHandlerSnapshot();
+	}
+	snapshot->handlers = handlerIndex;
+	snapshot->immediateHandlers = immediateHandlerIndex;
+
+	UbloxHandlerSnapshot *old = publishedHandlers.exchange(snapshot);
+	if (old) {
+		retiredSnapshots.push_back(old);
+	}
+}
+
+void Ublox::waitForHandlerReaders() {
+	// Readers that start now get the current snapshot, so only the ones already running are waited for
+	uint32_t ownReaders = 0;
+	if (isImmediateHandlerThread()) {
+		ownReaders = immediateCallDepth;
+	}
+
+	while(handlerReaders.load() > ownReaders) {
+		os_thread_yield();
+	}
+}
+
+void Ublox::reclaimHandlers() {
+	// Readers that start after this get the current snapshot, which has none of these handlers
+	if (handlerReaders.load() != 0) {
+		// Try again on the next loop
+		return;
+	}
+
+	// A removeHandler call that found one of these handlers before it was unlinked has linked it
+	// into removalInbox by now. Take them out of it before they're freed. Handlers this removes
+	// may still be in use, so they're left for the next time.
+	size_t numToDelete = handlersToDelete.size();
+	processHandlerInbox();
+
+	for(size_t ii = 0; ii < numToDelete; ii++) {
+		delete handlersToDelete[ii];
+	}
+	handlersToDelete.erase(handlersToDelete.begin(), handlersToDelete.begin() + numToDelete);
+
+	spareSnapshots.insert(spareSnapshots.end(), retiredSnapshots.begin(), retiredSnapshots.end());
+	retiredSnapshots.clear();
+}
+
+void Ublox::removeHandlerInternal(UbloxMessageHandler *handler) {
+	if (!handler->registered) {
+		return;
+	}
+	handler->registered = false;
+	handler->removed.store(true);
+
+	unlinkHandler(handler);
+	handlerTimers.remove(handler);
+
+	if (handler->immediate) {
+		immediateHandlerIndex.remove(handler);
+	}
+	else {
+		handlerIndex.remove(handler);
+	}
+	handlersChanged = true;
+
+	if (handler->immediate || !handler->removeAndDelete) {
+		// The decoding thread may have found the handler in the old snapshot, or removeHandler on
+		// the way to another handler. Wait for those calls to return so the caller can free it.
+		// A removeAndDelete handler is deleted by reclaimHandlers, which checks for readers itself.
+		publishHandlers();
+		waitForHandlerReaders();
+	}
 }
 
 void Ublox::addCommandToHandle(UbloxCommandBase *cmd) {
-	commandsToHandle.push_back(cmd);
+	if (!commandsToHandle.push(cmd)) {
+		UBLOX_DEBUG(("message queue full, dropped class=%02x id=%02x", cmd->getMsgClass(), cmd->getMsgId()));
+		UbloxCommandBase::deleteClone(cmd);
+	}
 }
 
 	
@@ -506,18 +1303,89 @@ void Ublox::configCommand(UbloxCommandBase *cmd, UbloxCommandCallback callback,
 }
 
 bool Ublox::configCommandSync(UbloxCommandBase *cmd, unsigned long timeout) {
+	if (!UbloxSyncCommand::canBlock()) {
+		return false;
+	}
 
 	UbloxSyncCommand syncCommand;
 
-	configCommand(cmd, [&syncCommand](UbloxCommandBase *, UbloxMessageHandler::Reason reason) {
-		syncCommand.completion(reason);
-	}, timeout);
+	configCommand(cmd, syncCommand.callback(), timeout);
 
-	UbloxMessageHandler::Reason reason = syncCommand.blockUntilCompletion();
+	UbloxMessageHandler::Reason reason = syncCommand.blockUntilCompletion(timeout);
 
 	return (reason == UbloxMessageHandler::Reason::ACK);
 }
 
+void Ublox::configTransaction(UbloxCommandBase * const *cmds, size_t numCmds, UbloxTransactionCallback callback, unsigned long timeout) {
+	struct TransactionState {
+		std::vector<UbloxMessageHandler::Reason> results;
+		size_t remaining;
+		UbloxTransactionCallback callback;
+	};
+
+	if (numCmds == 0) {
+		if (callback) {
+			callback(std::vector<UbloxMessageHandler::Reason>());
+		}
+		return;
+	}
+
+	std::shared_ptr<TransactionState> state = std::make_shared<TransactionState>();
+	state->results.resize(numCmds, UbloxMessageHandler::Reason::UNKNOWN);
+	state->remaining = numCmds;
+	state->callback = callback;
+
+	for(size_t ii = 0; ii < numCmds; ii++) {
+		configCommand(cmds[ii], [state, ii](UbloxCommandBase *, UbloxMessageHandler::Reason reason) {
+			state->results[ii] = reason;
+			if (--state->remaining == 0) {
+				UBLOX_DEBUG_VERBOSE(("configTransaction complete numCmds=%u", (unsigned) state->results.size()));
+				if (state->callback) {
+					state->callback(state->results);
+				}
+			}
+		}, timeout);
+	}
+}
+
+bool Ublox::configTransactionSync(UbloxCommandBase * const *cmds, size_t numCmds, std::vector<UbloxMessageHandler::Reason> *results, unsigned long timeout) {
+	if (!UbloxSyncCommand::canBlock()) {
+		if (results) {
+			results->assign(numCmds, UbloxMessageHandler::Reason::TIMEOUT);
+		}
+		return false;
+	}
+
+	UbloxSyncCommand syncCommand;
+	UbloxCommandCallback completion = syncCommand.callback();
+
+	// Shared with the callback in case it's called after the wait gives up
+	std::shared_ptr<std::vector<UbloxMessageHandler::Reason>> transactionResults = std::make_shared<std::vector<UbloxMessageHandler::Reason>>();
+
+	configTransaction(cmds, numCmds, [completion, transactionResults](const std::vector<UbloxMessageHandler::Reason> &results) {
+		*transactionResults = results;
+		completion(NULL, UbloxMessageHandler::Reason::COMPLETE);
+	}, timeout);
+
+	bool allAck = false;
+	if (syncCommand.blockUntilCompletion(timeout) == UbloxMessageHandler::Reason::COMPLETE) {
+		allAck = true;
+		for(auto it = transactionResults->begin(); it != transactionResults->end(); it++) {
+			if (*it != UbloxMessageHandler::Reason::ACK) {
+				allAck = false;
+			}
+		}
+		if (results) {
+			*results = *transactionResults;
+		}
+	}
+	else if (results) {
+		results->assign(numCmds, UbloxMessageHandler::Reason::TIMEOUT);
+	}
+
+	return allAck;
+}
+
 void Ublox::configGetSetValue(uint8_t msgClass, uint8_t msgId, UbloxCommandCallback callback, unsigned long timeout) {
 	
 	UBLOX_DEBUG_VERBOSE(("configGetSetValue class=%02x id=%02x", msgClass, msgId));
@@ -573,6 +1441,321 @@ void Ublox::sendCommand(UbloxCommandBase *cmd) {
 
 
 
+void Ublox::setBaudRate(uint32_t baud, UbloxCommandCallback callback, unsigned long timeout) {
+	AssetTrackerBase *tracker = AssetTrackerBase::getInstance();
+
+	if (tracker->usingI2C()) {
+		callback(NULL, UbloxMessageHandler::Reason::COMPLETE);
+		return;
+	}
+
+	uint32_t oldBaud = tracker->getSerialBaud();
+
+	// See if the GPS is already at the new rate by polling CFG-PRT for the port the poll arrives on
+	tracker->setSerialBaud(baud);
+
+	getValue(0x06, 0x00, [this,tracker,baud,oldBaud,callback,timeout](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		if (reason == UbloxMessageHandler::Reason::DATA) {
+			UBLOX_DEBUG_VERBOSE(("setBaudRate already at %lu", (unsigned long) baud));
+			callback(NULL, UbloxMessageHandler::Reason::COMPLETE);
+			return;
+		}
+
+		tracker->setSerialBaud(oldBaud);
+
+		getValue(0x06, 0x00, [this,tracker,baud,oldBaud,callback,timeout](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+			if (reason != UbloxMessageHandler::Reason::DATA) {
+				// Not responding at either rate
+				callback(cmd, reason);
+				return;
+			}
+
+			// Keep a copy of the port configuration in case it needs to be sent again at the old rate
+			std::shared_ptr<UbloxCommand<CFG_PRT_PAYLOAD_LEN>> prt = std::make_shared<UbloxCommand<CFG_PRT_PAYLOAD_LEN>>();
+			prt->setClassId(0x06, 0x00);
+			prt->setData(0, cmd->getData(), cmd->getPayloadLen());
+
+			// The ACK for this is sent while the GPS is changing rates so it's usually lost
+			cmd->setU4(8, baud); // baudRate
+			sendCommand(cmd);
+			delay(BAUD_CHANGE_DELAY_MS);
+
+			tracker->setSerialBaud(baud);
+
+			// Sending the same configuration again is ACKed at the new rate. cmd only needs to be valid
+			// until configCommand returns.
+			configCommand(cmd, [this,tracker,oldBaud,prt,callback](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+				if (reason == UbloxMessageHandler::Reason::ACK) {
+					callback(NULL, UbloxMessageHandler::Reason::COMPLETE);
+				}
+				else {
+					// The GPS may have switched and only the ACK was lost, so tell it to go back to
+					// the old rate (at the new rate) before moving the MCU back to the old rate
+					prt->setU4(8, oldBaud); // baudRate
+					sendCommand(prt.get());
+					delay(BAUD_CHANGE_DELAY_MS);
+
+					tracker->setSerialBaud(oldBaud);
+					callback(cmd, reason);
+				}
+			}, timeout);
+		}, timeout);
+	}, timeout);
+}
+
+bool Ublox::setNavigationRate(unsigned hz, UbloxCommandCallback callback, unsigned long timeout) {
+	if (!checkNavigationRate(hz)) {
+		UBLOX_DEBUG(("setNavigationRate %u Hz refused, not enough bandwidth", hz));
+		return false;
+	}
+
+	uint16_t measRate = (uint16_t) (1000 / hz);
+
+	configGetSetValue(0x06, 0x08, [this, callback, measRate](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		UBLOX_DEBUG_VERBOSE(("setNavigationRate reason=%d", (int) reason));
+
+		if (reason == UbloxMessageHandler::Reason::UPDATE) {
+			cmd->setU2(0, measRate); // measRate (ms)
+			cmd->setU2(2, 1); // navRate (cycles per navigation solution)
+			return;
+		}
+
+		if (reason == UbloxMessageHandler::Reason::ACK) {
+			// Publish a partial epoch before the next one is due. This runs on the handler thread while
+			// the GPS thread may be parsing, so only the (atomic) timeout is changed.
+			AssetTrackerBase::getInstance()->getTinyGPSPlus()->setEpochTimeout(measRate / 2);
+		}
+
+		callback(cmd, reason);
+	}, timeout);
+
+	return true;
+}
+
+bool Ublox::setNavigationRateSync(unsigned hz, unsigned long timeout) {
+	if (!UbloxSyncCommand::canBlock()) {
+		return false;
+	}
+
+	UbloxSyncCommand syncCommand;
+
+	if (!setNavigationRate(hz, syncCommand.callback(), timeout)) {
+		return false;
+	}
+
+	// Get, then set
+	UbloxMessageHandler::Reason reason = syncCommand.blockUntilCompletion(2 * timeout);
+
+	return (reason == UbloxMessageHandler::Reason::ACK);
+}
+
+bool Ublox::checkNavigationRate(unsigned hz) {
+	if (hz < 1 || hz > MAX_NAV_RATE_HZ) {
+		return false;
+	}
+	if (hz == 1) {
+		return true;
+	}
+
+	AssetTrackerBase *tracker = AssetTrackerBase::getInstance();
+
+	// The largest burst measured is what the receiver actually sends, including sentences that
+	// TinyGPS++ skips and UBX messages. Until a burst has been measured, assume the receiver's
+	// default NMEA output.
+	AssetTrackerThreadStats stats = tracker->getThreadStats();
+	uint32_t epochBytes = stats.epochBytesHighWater;
+	if (epochBytes == 0) {
+		epochBytes = estimateBytesPerEpoch(DEFAULT_NMEA_OUTPUT_MASK);
+	}
+
+	uint32_t linkBytes = tracker->usingI2C() ? I2C_BYTES_PER_SECOND : (tracker->getSerialBaud() / 10);
+
+	UBLOX_DEBUG_VERBOSE(("checkNavigationRate %u Hz epochBytes=%lu linkBytes=%lu", hz, (unsigned long) epochBytes, (unsigned long) linkBytes));
+
+	return (epochBytes * hz) <= (linkBytes * NAV_RATE_LINK_PERCENT / 100);
+}
+
+// [static]
+uint32_t Ublox::estimateBytesPerEpoch(uint32_t sentenceMask) {
+	// Typical longest sentence from a u-blox M8 using GPS and GLONASS, times the number of
+	// those sentences per epoch. GSA is output per GNSS, GSV is typically 4 sentences.
+	static const struct {
+		TinyGPSSentenceType type;
+		uint16_t bytes;
+	} sentenceBytes[] = {
+		{ TinyGPSSentenceType::RMC, 72 },
+		{ TinyGPSSentenceType::GGA, 78 },
+		{ TinyGPSSentenceType::GSA, 2 * 65 },
+		{ TinyGPSSentenceType::GSV, 4 * 70 },
+		{ TinyGPSSentenceType::VTG, 40 },
+		{ TinyGPSSentenceType::GLL, 52 },
+		{ TinyGPSSentenceType::ZDA, 40 },
+	};
+
+	uint32_t bytes = 0;
+
+	for(size_t ii = 0; ii < sizeof(sentenceBytes) / sizeof(sentenceBytes[0]); ii++) {
+		if (sentenceMask & TinyGPSPlus::sentenceBit(sentenceBytes[ii].type)) {
+			bytes += sentenceBytes[ii].bytes;
+		}
+	}
+	return bytes;
+}
+
+void Ublox::setMessageRate(uint8_t msgClass, uint8_t msgId, uint8_t rate, UbloxCommandCallback callback, unsigned long timeout) {
+	UbloxCommand<3> cmd;
+
+	cmd.setClassId(UbloxCommandBase::CLASS_UBX_CFG, UbloxCommandBase::MSG_UBX_CFG_MSG);
+	cmd.appendU1(msgClass);
+	cmd.appendU1(msgId);
+	cmd.appendU1(rate); // rate on the current port
+
+	configCommand(&cmd, callback, timeout);
+}
+
+void Ublox::setUbxOnly(bool ubxOnly, UbloxCommandCallback callback, uint8_t navSatRate, unsigned long timeout) {
+	if (ubxOnly) {
+		addNavPVTHandler();
+	}
+
+	configGetSetValue(UbloxCommandBase::CLASS_UBX_CFG, UbloxCommandBase::MSG_UBX_CFG_PRT, [this, ubxOnly, callback, navSatRate, timeout](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		UBLOX_DEBUG_VERBOSE(("setUbxOnly reason=%d", (int) reason));
+
+		if (reason == UbloxMessageHandler::Reason::UPDATE) {
+			// outProtoMask bit 0 = UBX, bit 1 = NMEA
+			uint16_t outProtoMask = cmd->getU2(14);
+			if (ubxOnly) {
+				outProtoMask = 0x0001;
+			}
+			else {
+				outProtoMask |= 0x0003;
+			}
+			cmd->setU2(14, outProtoMask);
+			return;
+		}
+
+		if (reason != UbloxMessageHandler::Reason::ACK) {
+			callback(cmd, reason);
+			return;
+		}
+
+		AssetTrackerBase::getInstance()->setNmeaParser(!ubxOnly);
+		if (!ubxOnly) {
+			callback(cmd, reason);
+			return;
+		}
+
+		// Both are CFG-MSG, so the ACKs have the same class and ID. Each command needs its own ACK
+		// handler, otherwise the NAV-SAT ACK would complete the NAV-PVT callback.
+		UbloxCommand<3> navSatCmd, navPvtCmd;
+		navSatCmd.setClassId(UbloxCommandBase::CLASS_UBX_CFG, UbloxCommandBase::MSG_UBX_CFG_MSG);
+		navSatCmd.appendU1(UbloxCommandBase::CLASS_UBX_NAV);
+		navSatCmd.appendU1(UbloxCommandBase::MSG_UBX_NAV_SAT);
+		navSatCmd.appendU1(navSatRate);
+
+		navPvtCmd.setClassId(UbloxCommandBase::CLASS_UBX_CFG, UbloxCommandBase::MSG_UBX_CFG_MSG);
+		navPvtCmd.appendU1(UbloxCommandBase::CLASS_UBX_NAV);
+		navPvtCmd.appendU1(UbloxCommandBase::MSG_UBX_NAV_PVT);
+		navPvtCmd.appendU1(1);
+
+		UbloxCommandBase *cmds[2] = { &navSatCmd, &navPvtCmd };
+		configTransaction(cmds, 2, [callback](const std::vector<UbloxMessageHandler::Reason> &results) {
+			UbloxMessageHandler::Reason result = UbloxMessageHandler::Reason::ACK;
+			for(auto it = results.begin(); it != results.end(); it++) {
+				if (*it != UbloxMessageHandler::Reason::ACK) {
+					result = *it;
+					break;
+				}
+			}
+			callback(NULL, result);
+		}, timeout);
+	}, timeout);
+}
+
+bool Ublox::setUbxOnlySync(bool ubxOnly, uint8_t navSatRate, unsigned long timeout) {
+	if (!UbloxSyncCommand::canBlock()) {
+		return false;
+	}
+
+	UbloxSyncCommand syncCommand;
+
+	setUbxOnly(ubxOnly, syncCommand.callback(), navSatRate, timeout);
+
+	// Get and set of CFG-PRT, then of CFG-MSG for NAV-SAT and NAV-PVT
+	UbloxMessageHandler::Reason reason = syncCommand.blockUntilCompletion(6 * timeout);
+
+	return (reason == UbloxMessageHandler::Reason::ACK);
+}
+
+void Ublox::addNavPVTHandler() {
+	if (navPvtHandlerAdded) {
+		return;
+	}
+	navPvtHandlerAdded = true;
+
+	UbloxMessageHandler *handler = new UbloxMessageHandler();
+
+	handler->classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	handler->idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+	handler->immediate = true;
+	handler->handler = [](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		TinyGPSNavSolution sol;
+
+		if (decodeNavPVT(cmd, sol)) {
+			AssetTrackerBase::getInstance()->getTinyGPSPlus()->encodeNavSolution(sol);
+		}
+	};
+
+	addHandler(handler);
+}
+
+// [static]
+bool Ublox::decodeNavPVT(const UbloxCommandBase *cmd, TinyGPSNavSolution &sol) {
+	if (cmd->getMsgClass() != UbloxCommandBase::CLASS_UBX_NAV || cmd->getMsgId() != UbloxCommandBase::MSG_UBX_NAV_PVT || cmd->getPayloadLen() < 92) {
+		return false;
+	}
+
+	uint8_t valid = cmd->getU1(11);
+	sol.dateValid = (valid & 0x01) != 0; // validDate
+	sol.timeValid = (valid & 0x02) != 0; // validTime
+	sol.date = cmd->getU1(7) * 10000UL + cmd->getU1(6) * 100UL + cmd->getU2(4) % 100;
+
+	// nano is the fraction of a second, and can be negative because the seconds are rounded
+	int32_t nano = (int32_t) cmd->getU4(16);
+	sol.time = cmd->getU1(8) * 1000000UL + cmd->getU1(9) * 10000UL + cmd->getU1(10) * 100UL + ((nano > 0) ? nano / 10000000 : 0);
+
+	sol.fixType = cmd->getU1(20);
+	// gnssFixOK and a 2D, 3D or GNSS + dead reckoning fix
+	sol.fixValid = (cmd->getU1(21) & 0x01) != 0 && sol.fixType >= 2 && sol.fixType <= 4;
+
+	sol.satellites = cmd->getU1(23);
+	sol.longitudeE7 = (int32_t) cmd->getU4(24);
+	sol.latitudeE7 = (int32_t) cmd->getU4(28);
+
+	// height above ellipsoid and mean sea level are in mm
+	int32_t height = (int32_t) cmd->getU4(32);
+	int32_t hMSL = (int32_t) cmd->getU4(36);
+	sol.altitude = hMSL / 10;
+	sol.geoidSeparation = (height - hMSL) / 10;
+
+	sol.horizontalAccuracy = cmd->getU4(40);
+	sol.verticalAccuracy = cmd->getU4(44);
+
+	// gSpeed is in mm/sec, 1 knot = 1852 m/hour
+	int32_t gSpeed = (int32_t) cmd->getU4(60);
+	sol.speed = (gSpeed * 360 + 926) / 1852;
+
+	// headMot is in 1e-5 degrees
+	sol.course = (int32_t) cmd->getU4(64) / 1000;
+
+	sol.speedAccuracy = cmd->getU4(68);
+
+	// NAV-PVT does not have HDOP, only pDOP
+	sol.pdop = cmd->getU2(76);
+
+	return true;
+}
+
 void Ublox::setAntenna(bool external) {
 	UbloxCommand<4> cmd;
 
@@ -639,19 +1822,25 @@ void Ublox::enableExtIntBackup(bool enable, UbloxCommandCallback callback, unsig
 }
 
 bool Ublox::enableExtIntBackupSync(bool enable, unsigned long timeout) {
+	if (!UbloxSyncCommand::canBlock()) {
+		return false;
+	}
+
 	UbloxSyncCommand syncCommand;
+	UbloxCommandCallback completion = syncCommand.callback();
 
-	enableExtIntBackup(enable, [&syncCommand](UbloxCommandBase *, UbloxMessageHandler::Reason reason) {
+	enableExtIntBackup(enable, [completion](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
 		// Completion of config setting results in ACK, but transform to COMPLETE here
 		// for consistency with other non-config calls.
 		if (reason == UbloxMessageHandler::Reason::ACK) {
 			reason = UbloxMessageHandler::Reason::COMPLETE;
 		}
 
-		syncCommand.completion(reason);
+		completion(cmd, reason);
 	}, timeout);
 
-	UbloxMessageHandler::Reason reason = syncCommand.blockUntilCompletion();
+	// Get, then set
+	UbloxMessageHandler::Reason reason = syncCommand.blockUntilCompletion(2 * timeout);
 
 	return (reason == UbloxMessageHandler::Reason::COMPLETE);
 }
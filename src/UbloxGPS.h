@@ -4,8 +4,13 @@
 #include "Particle.h"
 
 #include "google-maps-device-locator.h" // Only used if UbloxAssistNow is used
+#include "TinyGPS++.h"
 
-#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <unordered_map>
 #include <vector>
 
 //class UbloxCommandBase; // Foreward declaration
@@ -55,6 +60,14 @@ public:
 	 */
 	bool decode(char ch);
 
+	/**
+	 * @brief Decode a block of data
+	 *
+	 * This produces the same result as calling decode(char) for each byte, but skips over data
+	 * that is not UBX (such as NMEA sentences) with memchr and copies the payload at once.
+	 */
+	void decode(const uint8_t *buf, size_t len);
+
 	/**
 	 * @brief Used internally to discard invalid data. You probably won't need to call this.
 	 */
@@ -436,15 +449,30 @@ public:
 	UbloxCommandBase &withDeleteBuffer(bool value = true) { deleteBuffer = value; return *this; };
 
 	/**
-	 * @brief Make a modifyable clone of this object on the heap
+	 * @brief Make a modifyable clone of this object
+	 *
+	 * The clone only has room for the current message (payloadLen + HEADER_PLUS_CRC_LEN bytes). It comes
+	 * from UbloxMessagePool if there's a free block of that size, otherwise from the heap. Free it with
+	 * deleteClone(), not delete.
 	 */
 	UbloxCommandBase *clone();
 
+	/**
+	 * @brief Free an object returned by clone()
+	 */
+	static void deleteClone(UbloxCommandBase *cmd);
+
+	static const uint8_t CLASS_UBX_NAV = 0x01;			// 
+	static const uint8_t   MSG_UBX_NAV_PVT = 0x07;		// 
+	static const uint8_t   MSG_UBX_NAV_SAT = 0x35;		// 
+
 	static const uint8_t CLASS_UBX_ACK = 0x05;			// 
 	static const uint8_t   MSG_UBX_ACK_ACK = 0x01;		// 
 	static const uint8_t   MSG_UBX_ACK_NACK = 0x00;		// 
 
 	static const uint8_t CLASS_UBX_CFG = 0x06;			// 
+	static const uint8_t   MSG_UBX_CFG_PRT = 0x00;		// 
+	static const uint8_t   MSG_UBX_CFG_MSG = 0x01;		// 
 
 	static const uint8_t CLASS_UBX_ANY = 0xff;
 	static const uint8_t MSG_UBX_ANY = 0xff;
@@ -496,10 +524,138 @@ private:
 	uint8_t staticBuffer[HEADER_PLUS_CRC_LEN + PAYLOAD_SIZE]; //!< The static buffer to hold the data
 };
 
+struct UbloxMessagePoolStats;
+
+/**
+ * @brief Fixed-size blocks for the copies of received UBX messages that are passed to handlers
+ *
+ * A received message that has a handler is copied by UbloxCommandBase::clone() on the decoding
+ * thread and freed after the handlers are called from Ublox::loop(). The blocks are in a few
+ * size classes and hold both the UbloxCommandBase object and the message, so there's no heap
+ * allocation. Allocating and freeing are lock-free, so they can be done from different threads.
+ */
+class UbloxMessagePool {
+public:
+	/**
+	 * @brief Number of size classes
+	 */
+	static const size_t NUM_SIZE_CLASSES = 5;
+
+	/**
+	 * @brief Largest message (HEADER_PLUS_CRC_LEN + payload) that fits in a block
+	 *
+	 * This is UbloxNmeaDemux::UBX_MAX_PAYLOAD + 8, so every message the decoder accepts fits.
+	 * NAV-SAT (8 + 12 * numSvs bytes of payload) and the MGA messages use the two largest classes.
+	 */
+	static const size_t MAX_FRAME_SIZE = 1024 + 8;
+
+	/**
+	 * @brief Gets a UbloxCommandBase with room for frameLen bytes from the pool
+	 *
+	 * Returns NULL if frameLen is larger than MAX_FRAME_SIZE (counted as oversize) or if there's
+	 * no free block large enough (counted as exhausted).
+	 */
+	UbloxCommandBase *allocate(size_t frameLen);
+
+	/**
+	 * @brief Returns cmd to the pool if it came from the pool
+	 *
+	 * Returns false if cmd is not from the pool, in which case it must be deleted instead.
+	 */
+	bool release(UbloxCommandBase *cmd);
+
+	/**
+	 * @brief Gets the allocation, exhaustion and high-water statistics
+	 */
+	UbloxMessagePoolStats getStats() const;
+
+	/**
+	 * @brief Get the singleton instance of this class
+	 */
+	static UbloxMessagePool &getInstance();
+
+protected:
+	UbloxMessagePool();
+
+	uint32_t allocations = 0; 							//!< See UbloxMessagePoolStats
+	uint32_t exhausted = 0; 							//!< See UbloxMessagePoolStats
+	uint32_t oversize = 0; 								//!< See UbloxMessagePoolStats
+	uint8_t highWater[NUM_SIZE_CLASSES] = {}; 			//!< See UbloxMessagePoolStats
+	std::atomic<uint32_t> freeMask[NUM_SIZE_CLASSES]; 	//!< Bit set for each free block
+};
+
+/**
+ * @brief Statistics for UbloxMessagePool
+ */
+struct UbloxMessagePoolStats {
+	uint32_t allocations; 		//!< Number of clones that came from the pool
+	uint32_t exhausted; 		//!< Number of clones that came from the heap because every block large enough was in use
+	uint32_t oversize; 			//!< Number of clones that came from the heap because the message was larger than MAX_FRAME_SIZE
+	uint8_t inUse[UbloxMessagePool::NUM_SIZE_CLASSES]; 		//!< Blocks in use for each size class
+	uint8_t highWater[UbloxMessagePool::NUM_SIZE_CLASSES]; 	//!< Most blocks in use at once for each size class
+};
+
+/**
+ * @brief Statistics for UbloxMessageQueue
+ */
+struct UbloxMessageQueueStats {
+	uint32_t pushed; 			//!< Number of messages added to the queue
+	uint32_t dropped; 			//!< Number of messages discarded because the queue was full
+	uint8_t highWater; 			//!< Most messages in the queue at once
+};
+
+/**
+ * @brief Fixed-size queue of received messages, from the decoding thread to Ublox::loop()
+ *
+ * Only one thread may push (the one that decodes GPS data) and only one thread may pop (the
+ * one that calls Ublox::loop()). No locks are needed and it never allocates. When full, the
+ * newest message is dropped and counted.
+ */
+class UbloxMessageQueue {
+public:
+	/**
+	 * @brief Number of entries. Must be a power of 2.
+	 */
+	static const size_t CAPACITY = 32;
+
+	UbloxMessageQueue();
+
+	/**
+	 * @brief Adds a message to the queue. Returns false if it's full.
+	 *
+	 * If false is returned the caller still owns cmd and must free it.
+	 */
+	bool push(UbloxCommandBase *cmd);
+
+	/**
+	 * @brief Removes the oldest message from the queue. Returns NULL if it's empty.
+	 */
+	UbloxCommandBase *pop();
+
+	/**
+	 * @brief Gets the push, drop and high-water statistics
+	 */
+	UbloxMessageQueueStats getStats() const { return stats; };
+
+protected:
+	UbloxCommandBase *entries[CAPACITY];
+	std::atomic<uint32_t> head; 		//!< Next entry to pop, only written by the consumer
+	std::atomic<uint32_t> tail; 		//!< Next entry to push, only written by the producer
+	UbloxMessageQueueStats stats;
+};
+
+/**
+ * @brief Identifies a handler added with Ublox::addHandler(), for removing it later
+ *
+ * Tokens are never reused, so removing a handler that has already been removed is harmless.
+ * 0 is never a valid token.
+ */
+typedef uint32_t UbloxHandlerToken;
+
 /**
  * @brief Structure holding information about a message handler
  */
-typedef struct {
+typedef struct UbloxMessageHandler {
 	enum class Reason : uint8_t {
 		UNKNOWN = 0,// 0
 		DATA,		// 1
@@ -550,8 +706,69 @@ typedef struct {
 
 	/**
 	 * @brief Timeout time for ACK/NACK or response
+	 *
+	 * This is an absolute System.millis() value, 0 = no timeout. The handler is called once with
+	 * Reason::TIMEOUT after this time.
 	 */
 	uint64_t timeout = 0;
+
+	/**
+	 * @brief Call the handler from the thread that decodes the GPS data instead of from loop
+	 *
+	 * The message is not copied and the cmd passed to the handler is only valid until it returns.
+	 * The handler must return quickly, since removing any immediate handler waits for it. Timeouts
+	 * and removeAndDelete are not supported.
+	 *
+	 * The handler runs on the decoding thread (the loop thread if not in threaded mode) in the middle
+	 * of decoding. It can add and remove handlers and use the asynchronous methods, but the *Sync
+	 * methods return false without sending anything, since the response could only be decoded once the
+	 * handler has returned.
+	 */
+	bool immediate = false;
+
+	/**
+	 * @brief Used internally, the token returned by Ublox::addHandler()
+	 */
+	UbloxHandlerToken token = 0;
+
+	/**
+	 * @brief Used internally, true while the handler is being called
+	 *
+	 * A handler that calls a *Sync method runs callHandlers() again; this keeps it from being
+	 * called or deleted by the nested call.
+	 */
+	bool calling = false;
+
+	/**
+	 * @brief Used internally, set by Ublox::removeHandler() or when loop removes the handler
+	 *
+	 * Set from any thread, so the handler stops being called before loop has taken it out of the
+	 * index. Deleting a removeAndDelete handler is put off until callHandlers() returns to loop(),
+	 * so a handler removed by a nested call can still be checked.
+	 */
+	std::atomic<bool> removed{false};
+
+	/**
+	 * @brief Used internally by loop, true while the handler is in the index and timers
+	 */
+	bool registered = false;
+
+	/**
+	 * @brief Used internally to link handlers waiting to be added by Ublox::loop()
+	 */
+	struct UbloxMessageHandler *nextPending = NULL;
+
+	/**
+	 * @brief Used internally to link handlers waiting to be removed by Ublox::loop()
+	 */
+	struct UbloxMessageHandler *nextRemoval = NULL;
+
+	/**
+	 * @brief Used internally to link all the handlers from addHandler() until loop removes them
+	 *
+	 * Other threads follow it to look up a token; only loop unlinks handlers.
+	 */
+	std::atomic<struct UbloxMessageHandler *> nextRegistered{NULL};
 } UbloxMessageHandler;
 
 /**
@@ -559,22 +776,322 @@ typedef struct {
  */
 typedef std::function<void(UbloxCommandBase *, UbloxMessageHandler::Reason reason)> UbloxCommandCallback;
 
+/**
+ * @brief Transaction completion handler
+ *
+ * results has one entry per command, in the order they were passed to configTransaction: ACK,
+ * NACK, or TIMEOUT.
+ */
+typedef std::function<void(const std::vector<UbloxMessageHandler::Reason> &results)> UbloxTransactionCallback;
+
 
 /**
- * @brief
+ * @brief Waits for an asynchronous command to complete, used to implement the *Sync methods
+ *
+ * Pass callback() as the completion callback of the asynchronous call, then call
+ * blockUntilCompletion(). The state is shared with the callback, so it's safe for the callback
+ * to be called after blockUntilCompletion() gives up and this object is gone.
+ *
+ * From any thread other than the one that calls Ublox::loop(), this waits on a semaphore. From the
+ * Ublox::loop() thread, including from within a handler, nothing else would call the handlers,
+ * so it calls Ublox::callHandlers() (and AssetTrackerBase::updateGPS() if not in threaded mode)
+ * itself until the command completes.
+ *
+ * From an immediate handler it does not wait at all, as the thread that would decode the response
+ * is the one in the handler. The *Sync methods check canBlock() first so they return false without
+ * sending anything.
  */
 class UbloxSyncCommand {
 public:
 	UbloxSyncCommand();
 	virtual ~UbloxSyncCommand();
 
+	/**
+	 * @brief Marks the command as complete. Only the first call has an effect.
+	 */
 	void completion(UbloxMessageHandler::Reason reason);
 
-	UbloxMessageHandler::Reason blockUntilCompletion();
+	/**
+	 * @brief Returns a callback that calls completion(), for passing to an asynchronous method
+	 */
+	UbloxCommandCallback callback();
+
+	/**
+	 * @brief Returns false if the calling thread can't wait for a response, because it's in an immediate handler
+	 */
+	static bool canBlock();
+
+	/**
+	 * @brief Wait for completion
+	 *
+	 * @param timeout The timeout passed to the asynchronous call, in milliseconds. The wait gives up
+	 * DEADLINE_MARGIN_MS after this in case the timeout is never reported.
+	 *
+	 * @return The reason passed to completion(), or TIMEOUT if the deadline passed first or
+	 * canBlock() is false.
+	 */
+	UbloxMessageHandler::Reason blockUntilCompletion(unsigned long timeout);
+
+	/**
+	 * @brief Extra time to wait beyond the command timeout (milliseconds)
+	 */
+	static const unsigned long DEADLINE_MARGIN_MS = 1000;
+
+protected:
+	/**
+	 * @brief State shared with the callback
+	 */
+	struct State {
+		State();
+		~State();
+		void completion(UbloxMessageHandler::Reason reason);
+
+		os_semaphore_t semaphore = 0;
+		std::atomic<bool> done;
+		UbloxMessageHandler::Reason reason = UbloxMessageHandler::Reason::UNKNOWN;
+	};
+
+	std::shared_ptr<State> state;
+};
+
+/**
+ * @brief Message handlers indexed by the messages they match
+ *
+ * Handlers are kept in three buckets so finding the handlers for a message does not require
+ * scanning all of them:
+ *
+ * - Handlers for a specific class are keyed by (classFilter, idFilter). A handler with an
+ * idFilter of 0xff is keyed by (classFilter, 0xff) and matches any ID in that class.
+ * - Handlers for UBX-ACK (classFilter CLASS_UBX_ACK) are keyed by (origClassId, origMsgId) and
+ * match an ACK or NACK for that original message. If several are waiting for the same message,
+ * only the oldest matches, since the GPS acknowledges commands in the order they were sent.
+ * - Handlers with a classFilter of 0xff match any message and are kept in a separate list.
+ *
+ * Buckets are kept when they become empty, so a handler that is added and removed over and
+ * over (like the ACK handler of a configuration command) only allocates the first time.
+ *
+ * The index does no locking. Ublox only changes it from loop(), and the decoding thread reads a
+ * copy of it in a UbloxHandlerSnapshot, which is not changed once it has been published.
+ */
+class UbloxHandlerIndex {
+public:
+	/**
+	 * @brief Add a handler to the index
+	 */
+	void add(UbloxMessageHandler *handler);
+
+	/**
+	 * @brief Remove a handler from the index
+	 *
+	 * Returns true if it was found. The handler object is not deleted.
+	 */
+	bool remove(UbloxMessageHandler *handler);
+
+	/**
+	 * @brief Returns true if any handler matches cmd
+	 */
+	bool hasMatch(const UbloxCommandBase *cmd) const;
+
+	/**
+	 * @brief Appends the handlers that match cmd to matches
+	 *
+	 * The matches are copied so handlers can be removed from the index while calling them.
+	 */
+	void findMatches(const UbloxCommandBase *cmd, std::vector<UbloxMessageHandler*> &matches) const;
+
+	/**
+	 * @brief Calls fn(UbloxMessageHandler *) for each handler that matches cmd, in the same order as findMatches()
+	 *
+	 * Nothing is copied, so the index must not change until this returns.
+	 */
+	template<class Fn>
+	void forEachMatch(const UbloxCommandBase *cmd, Fn fn) const;
+
+	/**
+	 * @brief Makes the key used for the (class, id) and ACK buckets
+	 */
+	static uint16_t makeKey(uint8_t msgClass, uint8_t msgId) { return (uint16_t) ((msgClass << 8) | msgId); };
 
 protected:
-	os_mutex_t mutex;
-	UbloxMessageHandler::Reason reason;
+	static void removeFromBucket(std::vector<UbloxMessageHandler*> &bucket, UbloxMessageHandler *handler);
+
+	static bool hasHandlers(const std::unordered_map<uint16_t, std::vector<UbloxMessageHandler*>> &map, uint16_t key);
+
+	std::unordered_map<uint16_t, std::vector<UbloxMessageHandler*>> byClassId; 	//!< Handlers keyed by (classFilter, idFilter)
+	std::unordered_map<uint16_t, std::vector<UbloxMessageHandler*>> byAckOrig; 	//!< ACK/NACK handlers keyed by (origClassId, origMsgId)
+	std::vector<UbloxMessageHandler*> anyClass; 									//!< Handlers with classFilter 0xff
+};
+
+template<class Fn>
+void UbloxHandlerIndex::forEachMatch(const UbloxCommandBase *cmd, Fn fn) const {
+	if (cmd->getMsgClass() == UbloxCommandBase::CLASS_UBX_ACK) {
+		// Buckets are in the order the handlers were added, which is the order the commands were sent
+		auto it = byAckOrig.find(makeKey(cmd->getU1(0), cmd->getU1(1)));
+		if (it != byAckOrig.end() && !it->second.empty()) {
+			fn(it->second.front());
+		}
+	}
+	else {
+		auto it = byClassId.find(makeKey(cmd->getMsgClass(), cmd->getMsgId()));
+		if (it != byClassId.end()) {
+			for(auto it2 = it->second.begin(); it2 != it->second.end(); it2++) {
+				fn(*it2);
+			}
+		}
+
+		if (cmd->getMsgId() != UbloxCommandBase::MSG_UBX_ANY) {
+			it = byClassId.find(makeKey(cmd->getMsgClass(), UbloxCommandBase::MSG_UBX_ANY));
+			if (it != byClassId.end()) {
+				for(auto it2 = it->second.begin(); it2 != it->second.end(); it2++) {
+					fn(*it2);
+				}
+			}
+		}
+	}
+
+	for(auto it = anyClass.begin(); it != anyClass.end(); it++) {
+		auto handler = *it;
+		if (handler->idFilter == 0xff || handler->idFilter == cmd->getMsgId()) {
+			fn(handler);
+		}
+	}
+}
+
+/**
+ * @brief Copy of the Ublox handler indexes that the decoding thread reads without locking
+ *
+ * Ublox::loop() fills in a snapshot and publishes it by swapping a pointer. A published snapshot
+ * is never changed. One that has been replaced is only reused or freed once no thread is reading
+ * a snapshot, which each reader announces in Ublox::handlerReaders.
+ */
+struct UbloxHandlerSnapshot {
+	UbloxHandlerIndex handlers; 			//!< Copy of the handlers called from loop, for Ublox::hasHandler()
+	UbloxHandlerIndex immediateHandlers; 	//!< Copy of the immediate handlers, for Ublox::callImmediateHandlers()
+};
+
+/**
+ * @brief Timeouts of message handlers, ordered by deadline
+ *
+ * This is a min-heap so loop only needs to look at the earliest deadline instead of checking
+ * every handler. Removing a handler takes its entry out of the heap right away, so the heap
+ * never points to a handler that may have been freed. The vector keeps its capacity, so once
+ * it has grown, adding and removing timeouts does not allocate.
+ */
+class UbloxHandlerTimers {
+public:
+	/**
+	 * @brief Start the timeout for handler, if it has one (handler->timeout != 0)
+	 */
+	void add(UbloxMessageHandler *handler);
+
+	/**
+	 * @brief Cancel the timeout for handler, if it has one that has not been returned by popExpired()
+	 */
+	void remove(UbloxMessageHandler *handler);
+
+	/**
+	 * @brief Returns a handler whose timeout has passed, or NULL if there are none
+	 *
+	 * The timeout is cancelled by returning the handler so it is only returned once.
+	 */
+	UbloxMessageHandler *popExpired(uint64_t now);
+
+	/**
+	 * @brief Returns true if the deadline is before now
+	 *
+	 * The difference is done as signed so it's still correct if the millisecond counter wraps.
+	 */
+	static bool isExpired(uint64_t deadline, uint64_t now) { return (int64_t)(now - deadline) > 0; };
+
+protected:
+	/**
+	 * @brief Heap entry
+	 */
+	struct Entry {
+		uint64_t deadline;				//!< Absolute System.millis() value
+		UbloxMessageHandler *handler;	//!< Handler to call with Reason::TIMEOUT
+	};
+
+	static bool laterDeadline(const Entry &a, const Entry &b) { return isExpired(b.deadline, a.deadline); };
+
+	std::vector<Entry> heap;			//!< Min-heap by deadline
+};
+
+/**
+ * @brief Byte counts from UbloxNmeaDemux
+ */
+struct UbloxNmeaDemuxStats {
+	uint32_t nmeaBytes; 			//!< Bytes in NMEA sentences ($ to LF), passed to the NMEA decoder
+	uint32_t ubxBytes; 				//!< Bytes in UBX frames, passed to the UBX decoder
+	uint32_t discardedBytes; 		//!< Bytes that were not part of an NMEA or UBX frame
+	uint32_t framingErrors; 		//!< Frames that were cut off or had an invalid header
+};
+
+/**
+ * @brief Splits a stream that contains both NMEA sentences and UBX frames
+ *
+ * Each range of bytes is passed to only one of the two decoders, so neither has to look at
+ * the bytes of the other protocol. Ranges can span calls to decode(). Used by AssetTrackerBase
+ * when an external block decoder (Ublox) is set.
+ */
+class UbloxNmeaDemux {
+public:
+	/**
+	 * @brief Sets the function called with ranges of NMEA data
+	 *
+	 * It returns true if a sentence was completed.
+	 */
+	UbloxNmeaDemux &withNmeaDecoder(std::function<bool(const uint8_t *, size_t)> fn) { nmeaDecoder = fn; return *this; };
+
+	/**
+	 * @brief Sets the function called with ranges of UBX data
+	 */
+	UbloxNmeaDemux &withUbxDecoder(std::function<void(const uint8_t *, size_t)> fn) { ubxDecoder = fn; return *this; };
+
+	/**
+	 * @brief Splits buf and passes each range to its decoder
+	 *
+	 * Returns true if the NMEA decoder completed at least one sentence.
+	 */
+	bool decode(const uint8_t *buf, size_t len);
+
+	/**
+	 * @brief Gets the number of bytes of each protocol and framing errors
+	 */
+	UbloxNmeaDemuxStats getStats() const { return stats; };
+
+	/**
+	 * @brief NMEA sentences longer than this are treated as a framing error
+	 */
+	static const size_t NMEA_MAX_LEN = 128;
+
+	/**
+	 * @brief UBX payloads longer than this are treated as a framing error
+	 */
+	static const size_t UBX_MAX_PAYLOAD = 1024;
+
+protected:
+	/**
+	 * @brief State of the demultiplexer
+	 */
+	enum class State {
+		IDLE,			//!< Looking for '$' or 0xB5
+		UBX_SYNC,		//!< Got 0xB5, looking for 0x62
+		UBX_HEADER,		//!< In the class, ID and length of a UBX frame
+		UBX_BODY,		//!< In the payload and checksum of a UBX frame
+		NMEA			//!< In an NMEA sentence, looking for LF
+	};
+
+	bool decodeNmea(const uint8_t *buf, size_t len);
+	void decodeUbx(const uint8_t *buf, size_t len);
+
+	std::function<bool(const uint8_t *, size_t)> nmeaDecoder = 0;
+	std::function<void(const uint8_t *, size_t)> ubxDecoder = 0;
+	State state = State::IDLE;
+	size_t offset = 0; 				//!< Bytes of the NMEA sentence or UBX header so far
+	size_t remaining = 0; 			//!< Bytes left in the UBX payload and checksum
+	uint16_t payloadLen = 0;
+	UbloxNmeaDemuxStats stats = {};
 };
 
 /**
@@ -614,31 +1131,52 @@ public:
 	 *
 	 * @param handler A pointer to a filled in UbloxMessageHandler structure.
 	 *
-	 * Note the handler object  must remain valid until removeHandler is called on it, so you probably want
-	 * to make it a global variable or allocated with new. The exception is if you have a blocking function
-	 * call and add and remove the handler within the scope of the function, then you can allocate the
-	 * object on the stack.
+	 * @return A token to pass to removeHandler()
+	 *
+	 * Note the handler object must remain valid until it has been removed, which is not when removeHandler()
+	 * returns but on the next loop() after that. You probably want to make it a global variable or allocate it
+	 * with new and set removeAndDelete. A handler on the stack is only safe if the function calls
+	 * removeHandler() and then loop() (or callHandlers()) from the loop thread before it returns.
+	 *
+	 * This can be called from any thread, including from a handler. It does not lock or allocate; the
+	 * handler is linked into an inbox and starts receiving messages on the next loop().
 	 */
-	void addHandler(UbloxMessageHandler *handler);
+	UbloxHandlerToken addHandler(UbloxMessageHandler *handler);
 
 	/**
 	 * @brief Remove a message handler
 	 * 
-	 * @param handler The handler to remove (same value you passed to addHandler)
+	 * @param token The value returned from addHandler()
 	 * 
-	 * Note this will not free handler as it can't know if it was allocated on the stack, as a 
-	 * class member, global variable, or new. If you allocated the object with new, don't forget
-	 * to delete it!
+	 * @return true if the handler was found, false if token is 0 or the handler has already been
+	 * taken out by loop (including a removeAndDelete handler that has been called)
+	 *
+	 * This can be called from any thread. It does not lock or allocate, so it can't fail for a handler
+	 * that has been added: the handler is marked removed and linked into a list that the next loop()
+	 * takes out of the index. A handler that's not already running is not called after this returns.
+	 * If the handler has removeAndDelete set it's deleted then. Otherwise it's not freed as it can't know
+	 * if it was allocated on the stack, as a class member, global variable, or new, and it must remain
+	 * valid until the next loop() has run. Removing an immediate handler waits for a call to it on the
+	 * decoding thread to return. A handler can only be added again once its removal has taken effect.
 	 */
-	// void removeHandler(UbloxMessageHandler *handler);
+	bool removeHandler(UbloxHandlerToken token);
 
 	/**
 	 * @brief Returns true if cmd has a registered command handler
 	 * 
-	 * This eliminates the need to clone if the message will just be discarded.
+	 * This eliminates the need to clone if the message will just be discarded. Handlers added since the
+	 * last loop() are counted by message class, so a message in a class a new handler is waiting for
+	 * (such as an ACK) is kept. It does not lock, as it's called from the decoding thread for every message.
 	 */
 	bool hasHandler(UbloxCommandBase *cmd);
 
+	/**
+	 * @brief Used internally from the decoding thread to call the immediate handlers that match this class and id
+	 *
+	 * It does not lock. The handlers are found in the snapshot of the index published by loop().
+	 */
+	void callImmediateHandlers(UbloxCommandBase *cmd);
+
 	/**
 	 * @brief Used internally from loop to call all of the message handlers that match this class and id
 	 */
@@ -648,9 +1186,17 @@ public:
 	 * @brief Add a command to be handled from loop
 	 * 
 	 * @param cmd The command object. It must be a copy, returned from clone().
+	 *
+	 * Must only be called from the decoding thread. If the queue is full, cmd is freed and
+	 * counted in getMessageQueueStats().
 	 */
 	void addCommandToHandle(UbloxCommandBase *cmd);
 
+	/**
+	 * @brief Gets statistics for the queue of received messages waiting for loop
+	 */
+	UbloxMessageQueueStats getMessageQueueStats() const { return commandsToHandle.getStats(); };
+
 	/**
 	 * @brief Asynchronous config (CFG 0x06)
 	 */
@@ -663,6 +1209,39 @@ public:
 	 */
 	bool configCommandSync(UbloxCommandBase *cmd, unsigned long timeout = 5000);
 
+	/**
+	 * @brief Send several config (CFG 0x06) commands without waiting for each ACK
+	 *
+	 * @param cmds Array of commands. They only need to remain valid until this returns.
+	 *
+	 * @param numCmds Number of commands in cmds
+	 *
+	 * @param callback Called from loop once every command has been ACKed, NACKed or timed out.
+	 *
+	 * @param timeout Timeout for each ACK in milliseconds, measured from when the commands are sent
+	 *
+	 * The commands are sent back to back, so the total time is about one round trip instead of one
+	 * per command. Each ACK/NACK is matched to its command by class and ID. Commands with the same
+	 * class and ID are matched in the order they were sent. Don't include a CFG-PRT that changes
+	 * the baud rate of the port in use, as the commands after it would be lost.
+	 *
+	 * Because ACKs for the same class and ID go to the oldest command still waiting, a lost ACK
+	 * shifts the results of the later commands with that class and ID: each gets the result of the
+	 * command before it, and the last one gets TIMEOUT. Only the count of ACKs is reliable in that
+	 * case, so put commands that need individual results in separate transactions or give them
+	 * different class and IDs.
+	 */
+	void configTransaction(UbloxCommandBase * const *cmds, size_t numCmds, UbloxTransactionCallback callback, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Synchronous version of configTransaction
+	 *
+	 * @param results If not NULL, filled in with the result for each command
+	 *
+	 * @return true if every command was ACKed
+	 */
+	bool configTransactionSync(UbloxCommandBase * const *cmds, size_t numCmds, std::vector<UbloxMessageHandler::Reason> *results = NULL, unsigned long timeout = 5000);
+
 	void configGetSetValue(uint8_t msgClass, uint8_t msgId, UbloxCommandCallback callback, unsigned long timeout);
 
 	/**
@@ -707,6 +1286,188 @@ public:
 	void sendCommand(UbloxCommandBase *cmd);
 
 
+	/**
+	 * @brief Change the serial baud rate of the GPS and the MCU serial port
+	 *
+	 * @param baud The new baud rate, such as 115200 or 230400
+	 *
+	 * @param callback Called with COMPLETE when the GPS is communicating at the new rate. On failure,
+	 * it's called with TIMEOUT or NACK and the serial port is set back to the rate it was at before.
+	 *
+	 * @param timeout Timeout for each step in milliseconds
+	 *
+	 * The GPS is first polled at the new rate, so a GPS that is already at the new rate (for example,
+	 * when only the MCU was reset) is detected without changing anything. Otherwise UBX-CFG-PRT is sent
+	 * at the current rate, the serial port is reopened at the new rate, and the same CFG-PRT is sent
+	 * again, which must be ACKed at the new rate. If it isn't, CFG-PRT with the old rate is sent at the
+	 * new rate (in case only the ACK was lost) and the serial port is set back to the old rate.
+	 *
+	 * In I2C mode there is no baud rate so the callback is called with COMPLETE immediately.
+	 */
+	void setBaudRate(uint32_t baud, UbloxCommandCallback callback, unsigned long timeout = 1000);
+
+	/**
+	 * @brief Change the baud rate to baud from setup()
+	 *
+	 * @param baud The baud rate to use, such as 115200 or 230400. 0 (the default) leaves the baud rate alone.
+	 */
+	Ublox &withBaudRate(uint32_t baud) { setupBaud = baud; return *this; };
+
+	/**
+	 * @brief Time to wait after sending CFG-PRT for the GPS to switch rates (milliseconds)
+	 */
+	static const unsigned long BAUD_CHANGE_DELAY_MS = 100;
+
+	/**
+	 * @brief Payload length of UBX-CFG-PRT for a UART port
+	 */
+	static const size_t CFG_PRT_PAYLOAD_LEN = 20;
+
+	/**
+	 * @brief Change the navigation (measurement) rate with UBX-CFG-RATE
+	 *
+	 * @param hz Number of fixes per second, 1 to MAX_NAV_RATE_HZ
+	 *
+	 * @param callback Called with ACK on success, or NACK or TIMEOUT
+	 *
+	 * @param timeout Timeout in milliseconds
+	 *
+	 * Returns false without sending anything if checkNavigationRate() says the link can't carry
+	 * that many epochs per second; use setBaudRate() or disable sentences with UBX-CFG-MSG first.
+	 * After disabling sentences, call AssetTrackerBase::resetThreadStats() and wait for a burst so
+	 * the smaller output is measured.
+	 * On success, the TinyGPS++ epoch timeout is set to half of the new measurement period.
+	 */
+	bool setNavigationRate(unsigned hz, UbloxCommandCallback callback, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Synchronous version of setNavigationRate()
+	 *
+	 * @return true if ACK is returned, false if the rate is refused, NAK or timeout occurs
+	 */
+	bool setNavigationRateSync(unsigned hz, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Checks if the link to the GPS has the bandwidth for hz epochs per second
+	 *
+	 * The bytes per epoch is the largest GPS burst measured by AssetTrackerBase, which counts
+	 * everything the receiver sends whether it's parsed or not. Before a burst has been measured,
+	 * it's estimateBytesPerEpoch() for the u-blox default NMEA output, DEFAULT_NMEA_OUTPUT_MASK. The link
+	 * bandwidth is the serial baud rate / 10, or I2C_BYTES_PER_SECOND for I2C. Only
+	 * NAV_RATE_LINK_PERCENT of the bandwidth is used, the rest is left for UBX messages and
+	 * timing variation. 1 Hz, the GPS default, is always allowed.
+	 */
+	bool checkNavigationRate(unsigned hz);
+
+	/**
+	 * @brief Estimate of the number of NMEA bytes in one epoch
+	 *
+	 * @param sentenceMask A bitwise OR of TinyGPSPlus::sentenceBit() values for the sentences
+	 * the GPS outputs
+	 */
+	static uint32_t estimateBytesPerEpoch(uint32_t sentenceMask);
+
+	/**
+	 * @brief Sentences a u-blox M8 outputs by default: RMC, VTG, GGA, GSA, GSV and GLL
+	 */
+	static const uint32_t DEFAULT_NMEA_OUTPUT_MASK =
+		(1UL << (uint8_t)TinyGPSSentenceType::RMC) | (1UL << (uint8_t)TinyGPSSentenceType::VTG) |
+		(1UL << (uint8_t)TinyGPSSentenceType::GGA) | (1UL << (uint8_t)TinyGPSSentenceType::GSA) |
+		(1UL << (uint8_t)TinyGPSSentenceType::GSV) | (1UL << (uint8_t)TinyGPSSentenceType::GLL);
+
+	/**
+	 * @brief Highest navigation rate for setNavigationRate() (u-blox M8 with more than one GNSS)
+	 */
+	static const unsigned MAX_NAV_RATE_HZ = 10;
+
+	/**
+	 * @brief Percentage of the link bandwidth that checkNavigationRate() allows to be used
+	 */
+	static const uint32_t NAV_RATE_LINK_PERCENT = 70;
+
+	/**
+	 * @brief Approximate data rate for I2C at 100 kHz (9 clocks per byte)
+	 */
+	static const uint32_t I2C_BYTES_PER_SECOND = 11000;
+
+	/**
+	 * @brief Set how often a message is output on the current port with UBX-CFG-MSG
+	 *
+	 * @param msgClass The class of the message
+	 *
+	 * @param msgId The ID of the message
+	 *
+	 * @param rate Output once every rate navigation solutions, or 0 to disable the message
+	 *
+	 * @param callback Called with ACK, NACK, or TIMEOUT. May be NULL.
+	 *
+	 * @param timeout Timeout in milliseconds
+	 */
+	void setMessageRate(uint8_t msgClass, uint8_t msgId, uint8_t rate, UbloxCommandCallback callback = NULL, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Decode the UBX-NAV-PVT messages into TinyGPS++ from setup()
+	 *
+	 * @param enable true to add the NAV-PVT decoder and enable NAV-PVT output every epoch.
+	 *
+	 * The location, time, speed, etc. are then available from TinyGPS++ and LegacyAdapter the same
+	 * as from NMEA, along with the accuracy estimates from TinyGPSData::getAccuracy().
+	 */
+	Ublox &withNavPVT(bool enable = true) { navPvt = enable; return *this; };
+
+	/**
+	 * @brief Adds the handler that decodes UBX-NAV-PVT into TinyGPS++
+	 *
+	 * This is called from setup() when withNavPVT() is used, and by setUbxOnly(). It's only added once.
+	 * It does not enable the message on the GPS.
+	 */
+	void addNavPVTHandler();
+
+	/**
+	 * @brief Decode a UBX-NAV-PVT message into a TinyGPSNavSolution
+	 *
+	 * @param cmd The NAV-PVT message (92 byte payload)
+	 *
+	 * @param sol Filled in with the values converted to TinyGPS++ units
+	 *
+	 * Returns false if the message is not NAV-PVT or is too short.
+	 *
+	 * NAV-PVT has pDOP but no HDOP. sol.pdop is the pDOP, which TinyGPSPlus::encodeNavSolution() stores
+	 * as getPDOP(). getHDOP() is not changed by NAV-PVT, so enable GGA if the HDOP is needed.
+	 */
+	static bool decodeNavPVT(const UbloxCommandBase *cmd, TinyGPSNavSolution &sol);
+
+	/**
+	 * @brief Switch the GPS port to UBX output only, or back to UBX and NMEA
+	 *
+	 * @param ubxOnly true to turn off NMEA output, false to turn it back on
+	 *
+	 * @param callback Called with ACK on success, or NACK or TIMEOUT. In UBX-only mode the final result
+	 * covers both of the CFG-MSG commands, and cmd is NULL.
+	 *
+	 * @param navSatRate Output UBX-NAV-SAT every navSatRate solutions, 0 to leave it off. It's not
+	 * decoded here, add a handler for it if you need the satellite information.
+	 *
+	 * @param timeout Timeout for each step in milliseconds
+	 *
+	 * The outProtoMask of the current port is changed with UBX-CFG-PRT. In UBX-only mode NAV-PVT is
+	 * enabled every epoch and decoded into TinyGPS++ (see withNavPVT()), and AssetTrackerBase stops
+	 * passing the data to the NMEA parser.
+	 */
+	void setUbxOnly(bool ubxOnly, UbloxCommandCallback callback, uint8_t navSatRate = 0, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Synchronous version of setUbxOnly()
+	 *
+	 * @return true if ACK is returned, false if NAK or timeout occurs
+	 */
+	bool setUbxOnlySync(bool ubxOnly, uint8_t navSatRate = 0, unsigned long timeout = 5000);
+
+	/**
+	 * @brief Switch to UBX-only mode from setup()
+	 */
+	Ublox &withUbxOnly(bool enable = true) { ubxOnly = enable; return *this; };
+
 	/**
 	 * @brief Sets the antenna to external or internal on the AssetTracker V2.
 	 */
@@ -769,17 +1530,115 @@ public:
 	 */
 	void resetReceiver(StartType startType, ResetMode resetMode = ResetMode::CONTROLLED_SOFTWARE_RESET);
 
+	/**
+	 * @brief Returns true if called from the thread that calls setup() and loop()
+	 *
+	 * Returns false before setup() has been called, since the thread is not known yet.
+	 */
+	bool isHandlerThread() const;
+
+	/**
+	 * @brief Returns true if called from within an immediate handler
+	 */
+	bool isImmediateHandlerThread() const;
+
 	/**
 	 * @brief Get the singleton instance of this class
 	 */
 	static Ublox *getInstance() { return instance; };
 
 protected:
-	UbloxCommand<100> incomingCommand;
+	/**
+	 * @brief Number of pendingByClass counters. The last one is for handlers with a classFilter of 0xff.
+	 */
+	static const size_t PENDING_CLASS_SLOTS = 33;
+
+	/**
+	 * @brief Largest UBX payload that can be received
+	 *
+	 * Matches UbloxNmeaDemux::UBX_MAX_PAYLOAD. NAV-SAT is 8 + 12 * numSvs bytes, which is
+	 * more than 800 bytes with all GNSS enabled.
+	 */
+	static const size_t INCOMING_MAX_PAYLOAD = UbloxNmeaDemux::UBX_MAX_PAYLOAD;
+
+	/**
+	 * @brief Sends the setup() message configuration: withUbxOnly() or withNavPVT()
+	 */
+	void setupMessages();
+
+	UbloxCommand<INCOMING_MAX_PAYLOAD> incomingCommand;
+	uint32_t setupBaud = 0;
+	bool navPvt = false;
+	bool navPvtHandlerAdded = false;
+	bool ubxOnly = false;
 	
-	std::deque<UbloxCommandBase *> commandsToHandle; 
-	std::vector<UbloxMessageHandler*> handlers;  	//!< Vector of message handler objects, contains filter and callback function to handle incoming messages
-	std::vector<UbloxMessageHandler*> handlersToAdd; 
+	UbloxMessageQueue commandsToHandle; 			//!< Received messages to pass to handlers from loop
+	UbloxHandlerIndex handlerIndex; 				//!< Index of the handlers called from loop, by the messages they match
+	UbloxHandlerIndex immediateHandlerIndex; 		//!< Index of the handlers called from the decoding thread
+	std::vector<UbloxMessageHandler*> matchingHandlers; //!< Spare vector for the matching handlers, reused by callHandlers
+	UbloxHandlerTimers handlerTimers; 				//!< Timeouts of the registered handlers
+	os_thread_t handlerThread = 0; 					//!< Thread that called setup(), 0 before setup()
+	uint8_t callHandlersDepth = 0; 				//!< Number of callHandlers() calls on the stack
+	std::vector<UbloxMessageHandler*> handlersToDelete; //!< removeAndDelete handlers to delete when callHandlers() returns to loop
+
+	std::atomic<UbloxMessageHandler*> handlerInbox; //!< Handlers waiting to be added by loop, linked by nextPending (newest first)
+	std::atomic<UbloxHandlerToken> nextToken; 		//!< Next token to return from addHandler
+	std::atomic<UbloxMessageHandler*> removalInbox; //!< Handlers marked removed and waiting for loop, linked by nextRemoval (newest first)
+	std::atomic<UbloxMessageHandler*> registeredHandlers; //!< All handlers from addHandler until loop removes them, linked by nextRegistered
+	std::atomic<uint16_t> pendingByClass[PENDING_CLASS_SLOTS]; //!< Loop handlers in handlerInbox, by pendingSlot() of their classFilter
+
+	std::atomic<UbloxHandlerSnapshot*> publishedHandlers; //!< Copy of the handler indexes read by the decoding thread, NULL until the first handler is added
+	std::atomic<uint32_t> handlerReaders; 			//!< Number of calls reading publishedHandlers or registeredHandlers, or calling an immediate handler
+	std::atomic<os_thread_t> immediateCallThread; 	//!< Thread calling immediate handlers, 0 if none
+	uint8_t immediateCallDepth = 0; 				//!< callImmediateHandlers() calls on the stack of immediateCallThread
+	bool handlersChanged = false; 					//!< The handler indexes have changed since publishHandlers()
+	std::vector<UbloxHandlerSnapshot*> retiredSnapshots; //!< Replaced snapshots that a reader may still be using
+	std::vector<UbloxHandlerSnapshot*> spareSnapshots; //!< Replaced snapshots that are no longer in use, reused by publishHandlers()
+
+	/**
+	 * @brief Index into pendingByClass for a message class. Classes share slots, which only makes hasHandler() keep more.
+	 */
+	static size_t pendingSlot(uint8_t msgClass) { return (msgClass == 0xff) ? (PENDING_CLASS_SLOTS - 1) : (msgClass % (PENDING_CLASS_SLOTS - 1)); };
+
+	/**
+	 * @brief Used internally to remove a handler from the handler index and timers
+	 */
+	void removeHandlerInternal(UbloxMessageHandler *handler);
+
+	/**
+	 * @brief Used internally from loop to apply the handlers added and removed from other threads
+	 */
+	void processHandlerInbox();
+
+	/**
+	 * @brief Used internally from loop to take a handler out of registeredHandlers
+	 *
+	 * Other threads may still be following the links through it, so the handler can only be freed or
+	 * added again once they are done (see waitForHandlerReaders()).
+	 */
+	void unlinkHandler(UbloxMessageHandler *handler);
+
+	/**
+	 * @brief Used internally to delete a removeAndDelete handler once it's no longer in use
+	 */
+	void deleteHandler(UbloxMessageHandler *handler);
+
+	/**
+	 * @brief Used internally from loop to publish the handler indexes to the decoding thread if they changed
+	 */
+	void publishHandlers();
+
+	/**
+	 * @brief Used internally from loop to wait until no other call is reading the handlers published before
+	 *
+	 * A thread that is in an immediate handler does not wait for its own calls.
+	 */
+	void waitForHandlerReaders();
+
+	/**
+	 * @brief Used internally from loop to free deleted handlers and reuse replaced snapshots if no call can be using them
+	 */
+	void reclaimHandlers();
 
 	static Ublox *instance;	//!< Singleton instance of this class 
 };
@@ -7,6 +7,27 @@
 
 int test1();
 int test2();
+int test3();
+int test4();
+int test5();
+int test6();
+int test7();
+int test8();
+int test9();
+int test10();
+int test11();
+int test12();
+int test13();
+int test14();
+int test15();
+int test16();
+int test17();
+int test18();
+int test19();
+int test20();
+int test21();
+int test22();
+int test23();
 
 bool approximatelyEqualFloat(float f1, float f2, float tolerance = 0.0005);
 
@@ -20,6 +41,90 @@ int main(int argc, char *argv[]) {
 	if (res) {
 		return res;
 	}
+	res = test3();
+	if (res) {
+		return res;
+	}
+	res = test4();
+	if (res) {
+		return res;
+	}
+	res = test5();
+	if (res) {
+		return res;
+	}
+	res = test6();
+	if (res) {
+		return res;
+	}
+	res = test7();
+	if (res) {
+		return res;
+	}
+	res = test8();
+	if (res) {
+		return res;
+	}
+	res = test9();
+	if (res) {
+		return res;
+	}
+	res = test10();
+	if (res) {
+		return res;
+	}
+	res = test11();
+	if (res) {
+		return res;
+	}
+	res = test12();
+	if (res) {
+		return res;
+	}
+	res = test13();
+	if (res) {
+		return res;
+	}
+	res = test14();
+	if (res) {
+		return res;
+	}
+	res = test15();
+	if (res) {
+		return res;
+	}
+	res = test16();
+	if (res) {
+		return res;
+	}
+	res = test17();
+	if (res) {
+		return res;
+	}
+	res = test18();
+	if (res) {
+		return res;
+	}
+	res = test19();
+	if (res) {
+		return res;
+	}
+	res = test20();
+	if (res) {
+		return res;
+	}
+	res = test21();
+	if (res) {
+		return res;
+	}
+	res = test22();
+	if (res) {
+		return res;
+	}
+	res = test23();
+	if (res) {
+		return res;
+	}
 	return 0;
 }
 
@@ -664,3 +769,1523 @@ int test2() {
 	return 0;
 }
 
+
+// Returns true if the parsed data in the two objects is the same
+bool sameData(const TinyGPSData &d1, const TinyGPSData &d2) {
+	TinyGPSData a, b;
+	d1.copyDataTo(a);
+	d2.copyDataTo(b);
+
+	RawDegrees aLat = a.location.rawLat(), bLat = b.location.rawLat();
+	RawDegrees aLng = a.location.rawLng(), bLng = b.location.rawLng();
+
+	return a.location.isValid() == b.location.isValid() &&
+		aLat.deg == bLat.deg && aLat.billionths == bLat.billionths && aLat.negative == bLat.negative &&
+		aLng.deg == bLng.deg && aLng.billionths == bLng.billionths && aLng.negative == bLng.negative &&
+		a.date.isValid() == b.date.isValid() && a.date.value() == b.date.value() &&
+		a.time.isValid() == b.time.isValid() && a.time.value() == b.time.value() &&
+		a.speed.isValid() == b.speed.isValid() && a.speed.value() == b.speed.value() &&
+		a.course.isValid() == b.course.isValid() && a.course.value() == b.course.value() &&
+		a.altitude.isValid() == b.altitude.isValid() && a.altitude.value() == b.altitude.value() &&
+		a.geoidSeparation.isValid() == b.geoidSeparation.isValid() && a.geoidSeparation.value() == b.geoidSeparation.value() &&
+		a.satellites.isValid() == b.satellites.isValid() && a.satellites.value() == b.satellites.value() &&
+		a.hdop.isValid() == b.hdop.isValid() && a.hdop.value() == b.hdop.value();
+}
+
+// Reads a whole test file into a malloc'ed buffer. Caller must free it.
+char *readFile(const char *path, size_t &len) {
+	FILE *fd = fopen(path, "r");
+	if (!fd) {
+		return 0;
+	}
+	fseek(fd, 0, SEEK_END);
+	len = (size_t) ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+
+	char *buf = (char *)malloc(len);
+	len = fread(buf, 1, len, fd);
+	fclose(fd);
+
+	return buf;
+}
+
+int test3() {
+	printf("test3 started\n");
+
+	// Block encode must produce the same results as encoding a byte at a time
+	const char *files[] = { "t1.txt", "t2.txt", "t3.txt", "t4.txt", "t5.txt" };
+
+	for(size_t fileNum = 0; fileNum < sizeof(files) / sizeof(files[0]); fileNum++) {
+		size_t len;
+		char *buf = readFile(files[fileNum], len);
+		if (!buf) {
+			printf("failed to open %s\n", files[fileNum]);
+			return 1;
+		}
+
+		TinyGPSPlus gpsByte, gpsBlock;
+		TinyGPSCustom customByte(gpsByte, "GNGSA", 15), customBlock(gpsBlock, "GNGSA", 15);
+
+		size_t byteSentences = 0, blockSentences = 0;
+		size_t chunkLen = 1;
+
+		for(size_t offset = 0; offset < len; ) {
+			// Vary the chunk size so chunk boundaries fall everywhere within words and terms
+			if (chunkLen > len - offset) {
+				chunkLen = len - offset;
+			}
+
+			for(size_t ii = 0; ii < chunkLen; ii++) {
+				if (gpsByte.encode(buf[offset + ii])) {
+					byteSentences++;
+				}
+			}
+			blockSentences += gpsBlock.encode(&buf[offset], chunkLen);
+			offset += chunkLen;
+
+			if (!sameData(gpsByte, gpsBlock) || strcmp(customByte.value(), customBlock.value()) != 0) {
+				printf("%s block encode data mismatch offset=%lu\n", files[fileNum], offset);
+				free(buf);
+				return 1;
+			}
+
+			chunkLen = (chunkLen % 37) + 1;
+		}
+
+		if (byteSentences != blockSentences ||
+			gpsByte.charsProcessed() != gpsBlock.charsProcessed() ||
+			gpsByte.passedChecksum() != gpsBlock.passedChecksum() ||
+			gpsByte.failedChecksum() != gpsBlock.failedChecksum() ||
+			gpsByte.sentencesWithFix() != gpsBlock.sentencesWithFix()) {
+			printf("%s block encode counter mismatch sentences=%lu,%lu chars=%u,%u passed=%u,%u\n", files[fileNum],
+				byteSentences, blockSentences, gpsByte.charsProcessed(), gpsBlock.charsProcessed(),
+				gpsByte.passedChecksum(), gpsBlock.passedChecksum());
+			free(buf);
+			return 1;
+		}
+
+		free(buf);
+	}
+
+	printf("test3 completed\n");
+	return 0;
+}
+
+int test4() {
+	printf("test4 started\n");
+
+	// Sentence identification
+	struct {
+		const char *sentence;
+		TinyGPSTalker talker;
+		TinyGPSSentenceType sentenceType;
+	} tests[] = {
+		{ "$GNRMC,143553.00,A,4228.21306,S,07503.88452,W,0.316,,231218,,,A*63", TinyGPSTalker::GN, TinyGPSSentenceType::RMC },
+		{ "$GNGGA,143540.00,,,,,0,03,3.73,,,,,,*4B", TinyGPSTalker::GN, TinyGPSSentenceType::GGA },
+		{ "$GNGSA,A,3,15,21,13,24,29,,,,,,,,3.12,1.85,2.52*1D", TinyGPSTalker::GN, TinyGPSSentenceType::GSA },
+		{ "$GPGSV,2,2,05,29,13,203,40*40", TinyGPSTalker::GP, TinyGPSSentenceType::GSV },
+		{ "$GLGSV,1,1,01,,,,35*62", TinyGPSTalker::GL, TinyGPSSentenceType::GSV },
+		{ "$GNGLL,4228.21282,N,07503.88480,W,143543.00,A,A*6B", TinyGPSTalker::GN, TinyGPSSentenceType::GLL },
+		{ "$GNTXT,01,01,02,u-blox AG - www.u-blox.com*4E", TinyGPSTalker::GN, TinyGPSSentenceType::TXT },
+	};
+
+	for(size_t ii = 0; ii < sizeof(tests) / sizeof(tests[0]); ii++) {
+		TinyGPSPlus gpst;
+
+		size_t sentences = gpst.encode(tests[ii].sentence, strlen(tests[ii].sentence));
+		sentences += gpst.encode("\r\n", 2);
+
+		if (sentences != 1 || gpst.talker() != tests[ii].talker || gpst.sentenceType() != tests[ii].sentenceType) {
+			printf("sentence identification failed sentences=%lu talker=%d type=%d %s\n",
+				sentences, (int)gpst.talker(), (int)gpst.sentenceType(), tests[ii].sentence);
+			return 1;
+		}
+	}
+
+	printf("test4 completed\n");
+	return 0;
+}
+
+int test5() {
+	printf("test5 started\n");
+
+	// Numeric fields are accumulated while the characters arrive and must match parseDecimal
+	// and parseDegrees on the complete field, including fields longer than the term buffer
+	struct {
+		const char *lat;
+		const char *lng;
+		const char *hdop;
+		const char *altitude;
+	} tests[] = {
+		{ "4228.21306", "07503.88452", "3.73", "105.3" },
+		{ "4228.213061234567", "07503.884529876543", "0.9", "-12.5" },
+		{ "0000.0000001", "18000.", ".5", "-.25" },
+		{ "8959.9999999", "17959.9999999", "99.99", "12345678.9" },
+	};
+
+	for(size_t ii = 0; ii < sizeof(tests) / sizeof(tests[0]); ii++) {
+		char sentence[256];
+		snprintf(sentence, sizeof(sentence), "$GPGGA,143540.00,%s,N,%s,E,1,08,%s,%s,M,,,,",
+			tests[ii].lat, tests[ii].lng, tests[ii].hdop, tests[ii].altitude);
+
+		uint8_t parity = 0;
+		for(const char *cp = &sentence[1]; *cp; cp++) {
+			parity ^= *cp;
+		}
+		snprintf(&sentence[strlen(sentence)], sizeof(sentence) - strlen(sentence), "*%02X\r\n", parity);
+
+		TinyGPSPlus gpst;
+		gpst.encode(sentence, strlen(sentence));
+
+		RawDegrees lat, lng;
+		TinyGPSPlus::parseDegrees(tests[ii].lat, lat);
+		TinyGPSPlus::parseDegrees(tests[ii].lng, lng);
+
+		TinyGPSLocation loc = gpst.getLocation();
+		if (gpst.passedChecksum() != 1 ||
+			loc.rawLat().deg != lat.deg || loc.rawLat().billionths != lat.billionths ||
+			loc.rawLng().deg != lng.deg || loc.rawLng().billionths != lng.billionths ||
+			gpst.getHDOP().value() != TinyGPSPlus::parseDecimal(tests[ii].hdop) ||
+			gpst.getAltitude().value() != TinyGPSPlus::parseDecimal(tests[ii].altitude) ||
+			gpst.getTime().value() != 14354000) {
+			printf("numeric field mismatch %s", sentence);
+			return 1;
+		}
+	}
+
+	printf("test5 completed\n");
+	return 0;
+}
+
+int test6() {
+	printf("test6 started\n");
+
+	// Fix snapshot
+	TinyGPSPlus gpst;
+	LegacyAdapter adapter(gpst);
+
+	FixSnapshot snap = adapter.getFixSnapshot();
+	if (snap.locationValid || snap.dateValid || snap.timeValid || snap.utcEpoch != 0) {
+		printf("empty snapshot is valid\n");
+		return 1;
+	}
+
+	const char *sentences[] = {
+		"$GNRMC,143553.00,A,4228.21306,S,07503.88452,W,0.316,,231218,,,A*63\r\n",
+		"$GNGGA,143553.00,4228.21306,S,07503.88452,W,1,05,3.73,125.6,M,-33.1,M,,*6E\r\n",
+	};
+	for(size_t ii = 0; ii < sizeof(sentences) / sizeof(sentences[0]); ii++) {
+		gpst.encode(sentences[ii], strlen(sentences[ii]));
+	}
+
+	snap = adapter.getFixSnapshot();
+	if (!snap.locationValid || snap.locationAge > 1000 ||
+		snap.latitudeE7 != -424702177 || snap.longitudeE7 != -750647420 ||
+		snap.altitude != 12560 || snap.geoidSeparation != -3310 || snap.speed != 31 ||
+		snap.hdop != 373 || snap.satellites != 5 ||
+		snap.date != 231218 || snap.time != 14355300 || snap.utcEpoch != 1545575753) {
+		printf("snapshot mismatch lat=%d lng=%d alt=%d sep=%d speed=%d hdop=%d sats=%u date=%u time=%u epoch=%u\n",
+			snap.latitudeE7, snap.longitudeE7, snap.altitude, snap.geoidSeparation, snap.speed,
+			snap.hdop, snap.satellites, snap.date, snap.time, snap.utcEpoch);
+		return 1;
+	}
+
+	printf("test6 completed\n");
+	return 0;
+}
+
+int test7() {
+	printf("test7 started\n");
+
+	// Custom fields registered in any order, several per term and sentence
+	TinyGPSPlus gpst;
+	TinyGPSCustom vdop(gpst, "GNGSA", 17);
+	TinyGPSCustom pdop(gpst, "GNGSA", 15);
+	TinyGPSCustom sv1(gpst, "GNGSA", 3);
+	TinyGPSCustom hdop(gpst, "GNGSA", 16);
+	TinyGPSCustom sv1Again(gpst, "GNGSA", 3);
+	TinyGPSCustom gsvCount(gpst, "GPGSV", 3);
+	TinyGPSCustom rmcDate(gpst, "GNRMC", 9);
+	TinyGPSCustom unused(gpst, "GNZDA", 1);
+	TinyGPSCustom otherTalker(gpst, "GPGSA", 3);
+	TinyGPSCustom pubxWeek(gpst, "PUBX", 5);
+
+	const char *sentences[] = {
+		"$GNGSA,A,3,15,21,13,24,29,,,,,,,,3.12,1.85,2.52*1D\r\n",
+		"$GPGSV,2,2,05,29,13,203,40*40\r\n",
+		"$GNRMC,143553.00,A,4228.21306,S,07503.88452,W,0.316,,231218,,,A*63\r\n",
+		"$PUBX,04,073731.00,091202,113851.00,1196,15D,1930035,-2660.664,43*71\r\n",
+	};
+	for(size_t ii = 0; ii < sizeof(sentences) / sizeof(sentences[0]); ii++) {
+		gpst.encode(sentences[ii], strlen(sentences[ii]));
+	}
+
+	if (otherTalker.isValid() || strcmp(pubxWeek.value(), "1196") != 0) {
+		printf("custom talker mismatch otherTalker=%s pubxWeek=%s\n", otherTalker.value(), pubxWeek.value());
+		return 1;
+	}
+
+	if (strcmp(pdop.value(), "3.12") != 0 || strcmp(hdop.value(), "1.85") != 0 || strcmp(vdop.value(), "2.52") != 0 ||
+		strcmp(sv1.value(), "15") != 0 || strcmp(sv1Again.value(), "15") != 0 ||
+		strcmp(gsvCount.value(), "05") != 0 || strcmp(rmcDate.value(), "231218") != 0 ||
+		unused.isValid()) {
+		printf("custom mismatch pdop=%s hdop=%s vdop=%s sv1=%s sv1Again=%s gsvCount=%s rmcDate=%s\n",
+			pdop.value(), hdop.value(), vdop.value(), sv1.value(), sv1Again.value(), gsvCount.value(), rmcDate.value());
+		return 1;
+	}
+
+	printf("test7 completed\n");
+	return 0;
+}
+
+int test8() {
+	printf("test8 started\n");
+
+	// Skipping sentences not in the sentence mask must not change the parsed data
+	const char *files[] = { "t1.txt", "t2.txt", "t3.txt", "t4.txt", "t5.txt" };
+	uint32_t mask = TinyGPSPlus::sentenceBit(TinyGPSSentenceType::RMC) | TinyGPSPlus::sentenceBit(TinyGPSSentenceType::GGA);
+	uint32_t totalSkipped = 0;
+
+	for(size_t fileNum = 0; fileNum < sizeof(files) / sizeof(files[0]); fileNum++) {
+		size_t len;
+		char *buf = readFile(files[fileNum], len);
+		if (!buf) {
+			printf("failed to open %s\n", files[fileNum]);
+			return 1;
+		}
+
+		TinyGPSPlus gpsAll, gpsByte, gpsBlock;
+		TinyGPSCustom customAll(gpsAll, "GNGSA", 15), customByte(gpsByte, "GNGSA", 15), customBlock(gpsBlock, "GNGSA", 15);
+		gpsByte.setSentenceMask(mask);
+		gpsBlock.setSentenceMask(mask);
+
+		size_t chunkLen = 1;
+		for(size_t offset = 0; offset < len; ) {
+			if (chunkLen > len - offset) {
+				chunkLen = len - offset;
+			}
+			for(size_t ii = 0; ii < chunkLen; ii++) {
+				gpsAll.encode(buf[offset + ii]);
+				gpsByte.encode(buf[offset + ii]);
+			}
+			gpsBlock.encode(&buf[offset], chunkLen);
+			offset += chunkLen;
+
+			if (!sameData(gpsAll, gpsByte) || !sameData(gpsAll, gpsBlock) ||
+				strcmp(customAll.value(), customByte.value()) != 0 || strcmp(customAll.value(), customBlock.value()) != 0) {
+				printf("%s sentence mask data mismatch offset=%lu\n", files[fileNum], offset);
+				free(buf);
+				return 1;
+			}
+
+			chunkLen = (chunkLen % 37) + 1;
+		}
+
+		if (gpsByte.passedChecksum() + gpsByte.skippedSentences() != gpsAll.passedChecksum() ||
+			gpsBlock.passedChecksum() != gpsByte.passedChecksum() ||
+			gpsBlock.skippedSentences() != gpsByte.skippedSentences() ||
+			gpsByte.failedChecksum() != gpsAll.failedChecksum() ||
+			gpsBlock.failedChecksum() != gpsAll.failedChecksum() ||
+			gpsByte.charsProcessed() != gpsAll.charsProcessed() ||
+			gpsBlock.charsProcessed() != gpsAll.charsProcessed()) {
+			printf("%s sentence mask counter mismatch passed=%u,%u,%u skipped=%u,%u failed=%u,%u,%u\n", files[fileNum],
+				gpsAll.passedChecksum(), gpsByte.passedChecksum(), gpsBlock.passedChecksum(),
+				gpsByte.skippedSentences(), gpsBlock.skippedSentences(),
+				gpsAll.failedChecksum(), gpsByte.failedChecksum(), gpsBlock.failedChecksum());
+			free(buf);
+			return 1;
+		}
+
+		totalSkipped += gpsByte.skippedSentences();
+		free(buf);
+	}
+
+	if (totalSkipped == 0) {
+		printf("no sentences were skipped\n");
+		return 1;
+	}
+
+	printf("test8 completed\n");
+	return 0;
+}
+
+int test9() {
+	printf("test9 started\n");
+
+	// Publish callback is called for each RMC and GGA, after the data is visible
+	TinyGPSPlus gpst;
+	int rmcCount = 0, ggaCount = 0, otherCount = 0;
+	int32_t lastLatitudeE7 = 0;
+
+	gpst.setPublishCallback([&](TinyGPSSentenceType sentenceType) {
+		switch(sentenceType) {
+		case TinyGPSSentenceType::RMC:
+			rmcCount++;
+			break;
+		case TinyGPSSentenceType::GGA:
+			ggaCount++;
+			break;
+		default:
+			otherCount++;
+			break;
+		}
+		FixSnapshot snap;
+		gpst.copyFixSnapshotTo(snap);
+		lastLatitudeE7 = snap.latitudeE7;
+	});
+
+	const char *sentences[] = {
+		"$GNGSA,A,3,15,21,13,24,29,,,,,,,,3.12,1.85,2.52*1D\r\n",
+		"$GNRMC,143553.00,A,4228.21306,S,07503.88452,W,0.316,,231218,,,A*63\r\n",
+		"$GPGSV,2,2,05,29,13,203,40*40\r\n",
+		"$GNGGA,143553.00,4228.21306,S,07503.88452,W,1,05,3.73,125.6,M,-33.1,M,,*6E\r\n",
+	};
+	for(size_t ii = 0; ii < sizeof(sentences) / sizeof(sentences[0]); ii++) {
+		gpst.encode(sentences[ii], strlen(sentences[ii]));
+	}
+
+	if (rmcCount != 1 || ggaCount != 1 || otherCount != 0 || lastLatitudeE7 != -424702177) {
+		printf("publish callback mismatch rmc=%d gga=%d other=%d lat=%d\n", rmcCount, ggaCount, otherCount, lastLatitudeE7);
+		return 1;
+	}
+
+	printf("test9 completed\n");
+	return 0;
+}
+
+int test10() {
+	printf("test10 started\n");
+
+	// Epoch coalescing of RMC and GGA
+	TinyGPSPlus gpst;
+	int publishCount = 0;
+	TinyGPSSentenceType lastType = TinyGPSSentenceType::OTHER;
+	FixSnapshot snap;
+
+	gpst.setEpochSentences(TinyGPSPlus::sentenceBit(TinyGPSSentenceType::RMC) | TinyGPSPlus::sentenceBit(TinyGPSSentenceType::GGA), 50);
+	gpst.setPublishCallback([&](TinyGPSSentenceType sentenceType) {
+		publishCount++;
+		lastType = sentenceType;
+		gpst.copyFixSnapshotTo(snap);
+	});
+
+	const char *rmc1 = "$GNRMC,143553.00,A,4228.21306,S,07503.88452,W,0.316,,231218,,,A*63\r\n";
+	const char *gga1 = "$GNGGA,143553.00,4228.21306,S,07503.88452,W,1,05,3.73,125.6,M,-33.1,M,,*6E\r\n";
+	const char *rmc2 = "$GNRMC,143554.00,A,4228.21317,S,07503.88439,W,0.438,,231218,,,A*62\r\n";
+	const char *rmc3 = "$GNRMC,143555.00,A,4228.21320,S,07503.88430,W,0.400,,231218,,,A*65\r\n";
+
+	// RMC alone is not published until the GGA for the same time arrives
+	gpst.encode(rmc1, strlen(rmc1));
+	if (publishCount != 0 || gpst.getTime().isValid()) {
+		printf("epoch published early\n");
+		return 1;
+	}
+	gpst.encode(gga1, strlen(gga1));
+	if (publishCount != 1 || lastType != TinyGPSSentenceType::GGA ||
+		snap.time != 14355300 || snap.speed != 31 || snap.satellites != 5 || snap.altitude != 12560) {
+		printf("epoch 1 mismatch count=%d time=%u speed=%d sats=%u\n", publishCount, snap.time, snap.speed, snap.satellites);
+		return 1;
+	}
+
+	// A sentence with a new time publishes the incomplete previous epoch
+	gpst.encode(rmc2, strlen(rmc2));
+	gpst.encode(rmc3, strlen(rmc3));
+	if (publishCount != 2 || lastType != TinyGPSSentenceType::RMC || snap.time != 14355400 || snap.speed != 43) {
+		printf("epoch 2 mismatch count=%d time=%u speed=%d\n", publishCount, snap.time, snap.speed);
+		return 1;
+	}
+
+	// And an incomplete epoch is published after the timeout
+	if (gpst.checkEpochTimeout()) {
+		printf("epoch timeout too soon\n");
+		return 1;
+	}
+	delay(60);
+	if (!gpst.checkEpochTimeout() || publishCount != 3 || snap.time != 14355500 || snap.speed != 40) {
+		printf("epoch 3 mismatch count=%d time=%u speed=%d\n", publishCount, snap.time, snap.speed);
+		return 1;
+	}
+
+	// When GGA is masked off, the epoch does not wait for it
+	gpst.setSentenceMask(TinyGPSPlus::sentenceBit(TinyGPSSentenceType::RMC));
+	gpst.encode(rmc1, strlen(rmc1));
+	if (publishCount != 4 || lastType != TinyGPSSentenceType::RMC || snap.time != 14355300) {
+		printf("masked epoch mismatch count=%d time=%u\n", publishCount, snap.time);
+		return 1;
+	}
+
+	printf("test10 completed\n");
+	return 0;
+}
+
+int test11() {
+	printf("test11 started\n");
+
+	// Fixed point accessors
+	TinyGPSPlus gpst;
+	const char *sentences[] = {
+		"$GNRMC,143553.00,A,4228.21306,S,07503.88452,W,0.316,,231218,,,A*63\r\n",
+		"$GNGGA,143553.00,4228.21306,S,07503.88452,W,1,05,3.73,125.6,M,-33.1,M,,*6E\r\n",
+	};
+	for(size_t ii = 0; ii < sizeof(sentences) / sizeof(sentences[0]); ii++) {
+		gpst.encode(sentences[ii], strlen(sentences[ii]));
+	}
+
+	TinyGPSLocation loc = gpst.getLocation();
+	TinyGPSSpeed speed = gpst.getSpeed();
+	TinyGPSAltitude altitude = gpst.getAltitude();
+	if (loc.latE7() != -424702177 || loc.lngE7() != -750647420 ||
+		speed.centiKnots() != 31 || speed.mmps() != 159 ||
+		altitude.centimeters() != 12560 || gpst.getCourse().centidegrees() != 0) {
+		printf("fixed point mismatch lat=%d lng=%d speed=%d mmps=%d alt=%d\n",
+			loc.latE7(), loc.lngE7(), speed.centiKnots(), speed.mmps(), altitude.centimeters());
+		return 1;
+	}
+
+	struct {
+		int32_t degE7;
+		int32_t degMinE5;
+	} tests[] = {
+		{ 424702177, 422821306 },
+		{ -424702177, 422821306 },
+		{ 750647420, 750388452 },
+		{ 0, 0 },
+		{ 1799999999, 1795999999 },
+	};
+	for(size_t ii = 0; ii < sizeof(tests) / sizeof(tests[0]); ii++) {
+		int32_t res = LegacyAdapter::convertToDegreesMinutesE5(tests[ii].degE7);
+		if (res != tests[ii].degMinE5) {
+			printf("convertToDegreesMinutesE5 %d got %d expected %d\n", tests[ii].degE7, res, tests[ii].degMinE5);
+			return 1;
+		}
+	}
+
+	printf("test11 completed\n");
+	return 0;
+}
+
+int test12() {
+	printf("test12 started\n");
+
+	// UBX-NAV-PVT decoding
+	UbloxCommand<92> cmd;
+	cmd.setClassId(0x01, 0x07);
+	cmd.fillData(0, 92);
+	cmd.setU2(4, 2018); // year
+	cmd.setU1(6, 12); // month
+	cmd.setU1(7, 23); // day
+	cmd.setU1(8, 14); // hour
+	cmd.setU1(9, 35); // min
+	cmd.setU1(10, 53); // sec
+	cmd.setU1(11, 0x07); // valid
+	cmd.setU4(16, 120000000); // nano
+	cmd.setU1(20, 3); // fixType
+	cmd.setU1(21, 0x01); // flags (gnssFixOK)
+	cmd.setU1(23, 5); // numSV
+	cmd.setU4(24, (uint32_t) -750647420); // lon
+	cmd.setU4(28, (uint32_t) -424702177); // lat
+	cmd.setU4(32, 92500); // height
+	cmd.setU4(36, 125600); // hMSL
+	cmd.setU4(40, 2500); // hAcc
+	cmd.setU4(44, 4100); // vAcc
+	cmd.setU4(60, 1000); // gSpeed
+	cmd.setU4(64, 12345678); // headMot
+	cmd.setU4(68, 300); // sAcc
+	cmd.setU2(76, 373); // pDOP
+
+	TinyGPSNavSolution sol;
+	if (!Ublox::decodeNavPVT(&cmd, sol)) {
+		printf("decodeNavPVT failed\n");
+		return 1;
+	}
+	if (sol.pdop != 373) {
+		printf("dop mismatch pdop=%d\n", sol.pdop);
+		return 1;
+	}
+
+	TinyGPSPlus gpst;
+	int publishCount = 0;
+	TinyGPSSentenceType lastType = TinyGPSSentenceType::OTHER;
+	gpst.setPublishCallback([&](TinyGPSSentenceType sentenceType) {
+		publishCount++;
+		lastType = sentenceType;
+	});
+	gpst.encodeNavSolution(sol);
+
+	if (publishCount != 1 || lastType != TinyGPSSentenceType::NAV_PVT) {
+		printf("publish mismatch count=%d\n", publishCount);
+		return 1;
+	}
+
+	LegacyAdapter adapter(gpst);
+	FixSnapshot snap = adapter.getFixSnapshot();
+	if (!snap.locationValid || snap.latitudeE7 != -424702177 || snap.longitudeE7 != -750647420 ||
+		snap.altitude != 12560 || snap.geoidSeparation != -3310 || snap.speed != 194 || snap.course != 12345 ||
+		snap.pdop != 373 || snap.satellites != 5 || snap.date != 231218 || snap.time != 14355312) {
+		printf("snapshot mismatch lat=%d lng=%d alt=%d geoid=%d speed=%d course=%d date=%u time=%u\n",
+			snap.latitudeE7, snap.longitudeE7, snap.altitude, snap.geoidSeparation, snap.speed, snap.course, snap.date, snap.time);
+		return 1;
+	}
+	// NAV-PVT has no HDOP, so it's left alone
+	if (gpst.getHDOP().isValid() || gpst.getPDOP().value() != 373) {
+		printf("dop mismatch hdop valid=%d pdop=%d\n", gpst.getHDOP().isValid(), gpst.getPDOP().value());
+		return 1;
+	}
+	const char *gga = "$GNGGA,143553.00,4228.21306,S,07503.88452,W,1,05,1.85,125.6,M,-33.1,M,,*65\r\n";
+	for(const char *cp = gga; *cp; cp++) {
+		gpst.encode(*cp);
+	}
+	gpst.encodeNavSolution(sol);
+	if (gpst.getHDOP().value() != 185 || gpst.getPDOP().value() != 373) {
+		printf("GGA hdop replaced hdop=%d pdop=%d\n", gpst.getHDOP().value(), gpst.getPDOP().value());
+		return 1;
+	}
+
+	if (!snap.accuracyValid || snap.horizontalAccuracy != 2500 || snap.verticalAccuracy != 4100 || snap.speedAccuracy != 300) {
+		printf("accuracy mismatch\n");
+		return 1;
+	}
+	if (!approximatelyEqualFloat(adapter.getGpsAccuracy(), 2.5)) {
+		printf("getGpsAccuracy mismatch %f\n", adapter.getGpsAccuracy());
+		return 1;
+	}
+	if (!approximatelyEqualFloat(adapter.readLat(), 4228.21306) || !approximatelyEqualFloat(adapter.readLatDeg(), -42.4702177)) {
+		printf("lat mismatch %f %f\n", adapter.readLat(), adapter.readLatDeg());
+		return 1;
+	}
+
+	// No fix
+	cmd.setU1(20, 0);
+	cmd.setU1(21, 0);
+	Ublox::decodeNavPVT(&cmd, sol);
+	gpst.encodeNavSolution(sol);
+	if (gpst.getLocation().isValid() || !gpst.getTime().isValid()) {
+		printf("no fix mismatch\n");
+		return 1;
+	}
+
+	printf("test12 completed\n");
+	return 0;
+}
+
+int test13() {
+	printf("test13 started\n");
+
+	// NMEA/UBX demultiplexer, with the stream split into blocks of every size
+	const char *rmc1 = "$GNRMC,143553.00,A,4228.21306,S,07503.88452,W,0.316,,231218,,,A*63\r\n";
+	const char *gga1 = "$GNGGA,143553.00,4228.21306,S,07503.88452,W,1,05,3.73,125.6,M,-33.1,M,,*6E\r\n";
+	const char *partial = "$GPTXT,01";
+	static const uint8_t badSync[] = { 0xB5, 0x00 };
+	static const uint8_t oversize[] = { 0xB5, 0x62, 0x06, 0x13, 0x00, 0x05 };
+
+	std::vector<uint8_t> stream;
+	std::string expectedNmea;
+	std::vector<uint8_t> expectedUbx;
+
+	auto addNmea = [&](const char *s) {
+		stream.insert(stream.end(), s, s + strlen(s));
+		expectedNmea += s;
+	};
+	auto addUbx = [&](const uint8_t *data, size_t len) {
+		stream.insert(stream.end(), data, data + len);
+		expectedUbx.insert(expectedUbx.end(), data, data + len);
+	};
+
+	stream.push_back('x');
+	stream.push_back('x');
+	addNmea(rmc1);
+	addUbx(internalANT, sizeof(internalANT));
+	stream.insert(stream.end(), badSync, badSync + sizeof(badSync));
+	addNmea(gga1);
+	addUbx(externalANT, sizeof(externalANT));
+	addNmea(partial); // cut off by the next UBX frame
+	addUbx(internalANT, sizeof(internalANT));
+	addUbx(oversize, sizeof(oversize)); // header is passed on, then it's a framing error
+
+	for(size_t blockSize = 1; blockSize <= stream.size(); blockSize++) {
+		std::string nmea;
+		std::vector<uint8_t> ubx;
+		bool hasSentence = false;
+
+		UbloxNmeaDemux demux;
+		demux.withNmeaDecoder([&](const uint8_t *buf, size_t len) {
+			nmea.append((const char *)buf, len);
+			return buf[len - 1] == '\n';
+		});
+		demux.withUbxDecoder([&](const uint8_t *buf, size_t len) {
+			ubx.insert(ubx.end(), buf, buf + len);
+		});
+
+		for(size_t offset = 0; offset < stream.size(); offset += blockSize) {
+			size_t len = std::min(blockSize, stream.size() - offset);
+			hasSentence |= demux.decode(&stream[offset], len);
+		}
+
+		if (nmea != expectedNmea || ubx != expectedUbx) {
+			printf("demux data mismatch blockSize=%lu nmea=%lu ubx=%lu\n", blockSize, nmea.size(), ubx.size());
+			return 1;
+		}
+		if (!hasSentence) {
+			printf("demux sentence not reported blockSize=%lu\n", blockSize);
+			return 1;
+		}
+
+		UbloxNmeaDemuxStats stats = demux.getStats();
+		if (stats.nmeaBytes != expectedNmea.size() || stats.ubxBytes != expectedUbx.size() ||
+			stats.discardedBytes != 4 || stats.framingErrors != 3) {
+			printf("demux stats mismatch blockSize=%lu nmea=%u ubx=%u discarded=%u framing=%u\n", blockSize,
+				stats.nmeaBytes, stats.ubxBytes, stats.discardedBytes, stats.framingErrors);
+			return 1;
+		}
+	}
+
+	printf("test13 completed\n");
+	return 0;
+}
+
+int test14() {
+	printf("test14 started\n");
+
+	// UbloxMessagePool size classes, exhaustion and oversize messages
+	UbloxMessagePool &pool = UbloxMessagePool::getInstance();
+	UbloxMessagePoolStats before = pool.getStats();
+
+	// Block size minus the 8 bytes of header and checksum
+	auto payloadCapacity = [](UbloxCommandBase *cmd) {
+		size_t count = 0;
+		while(cmd->fillData(0, 1)) {
+			count++;
+		}
+		return count;
+	};
+
+	std::vector<UbloxCommandBase *> small;
+	for(size_t ii = 0; ii < 8; ii++) {
+		UbloxCommandBase *cmd = pool.allocate(32);
+		if (!cmd || payloadCapacity(cmd) != 32 - 8) {
+			printf("small allocate failed ii=%lu\n", ii);
+			return 1;
+		}
+		small.push_back(cmd);
+	}
+
+	// The small class is full, so the next one comes from the 64 byte class
+	UbloxCommandBase *overflow = pool.allocate(20);
+	if (!overflow || payloadCapacity(overflow) != 64 - 8) {
+		printf("overflow allocate failed\n");
+		return 1;
+	}
+
+	UbloxCommandBase *oversize = pool.allocate(UbloxMessagePool::MAX_FRAME_SIZE + 1);
+	if (oversize) {
+		printf("oversize allocate should fail\n");
+		return 1;
+	}
+
+	UbloxMessagePoolStats stats = pool.getStats();
+	if (stats.allocations - before.allocations != 9 || stats.oversize - before.oversize != 1 || stats.exhausted != before.exhausted ||
+		stats.inUse[0] != 8 || stats.inUse[1] != 1 || stats.highWater[0] != 8) {
+		printf("pool stats mismatch allocations=%u oversize=%u exhausted=%u inUse=%u,%u\n",
+			stats.allocations, stats.oversize, stats.exhausted, stats.inUse[0], stats.inUse[1]);
+		return 1;
+	}
+
+	// Small messages use the larger classes until there are no blocks left
+	std::vector<UbloxCommandBase *> rest;
+	while(UbloxCommandBase *cmd = pool.allocate(8)) {
+		rest.push_back(cmd);
+	}
+	if (rest.size() != 7 + 4 + 4 + 1 || pool.allocate(8) || pool.getStats().exhausted - before.exhausted != 2) {
+		printf("pool exhaustion mismatch rest=%lu\n", rest.size());
+		return 1;
+	}
+
+	for(auto it = small.begin(); it != small.end(); it++) {
+		if (!pool.release(*it)) {
+			printf("release failed\n");
+			return 1;
+		}
+	}
+	for(auto it = rest.begin(); it != rest.end(); it++) {
+		pool.release(*it);
+	}
+	pool.release(overflow);
+
+	stats = pool.getStats();
+	for(size_t ii = 0; ii < UbloxMessagePool::NUM_SIZE_CLASSES; ii++) {
+		if (stats.inUse[ii] != 0) {
+			printf("blocks not released ii=%lu\n", ii);
+			return 1;
+		}
+	}
+
+	// clone() copies into a pool block, or the heap for a large message
+	UbloxCommand<200> cmd;
+	cmd.setClassId(0x01, 0x35);
+	cmd.fillData(0x5a, 100);
+	cmd.updateChecksum();
+
+	UbloxCommandBase *copy = cmd.clone();
+	if (!copy || copy->getPayloadLen() != 100 || copy->getU1(99) != 0x5a || pool.getStats().inUse[2] != 1) {
+		printf("pool clone mismatch\n");
+		return 1;
+	}
+	UbloxCommandBase::deleteClone(copy);
+
+	// NAV-SAT with 25 satellites is 8 + 12 * 25 bytes of payload and must not go to the heap
+	UbloxCommand<308> navSat;
+	navSat.setClassId(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_SAT);
+	navSat.fillData(0xa5, 308);
+	navSat.updateChecksum();
+
+	copy = navSat.clone();
+	stats = pool.getStats();
+	if (!copy || copy->getPayloadLen() != 308 || copy->getU1(307) != 0xa5 || stats.inUse[3] != 1 || stats.oversize - before.oversize != 1) {
+		printf("NAV-SAT clone mismatch oversize=%u\n", stats.oversize - before.oversize);
+		return 1;
+	}
+	UbloxCommandBase::deleteClone(copy);
+
+	// The largest message the decoder accepts also fits
+	UbloxCommand<1024> large;
+	large.setClassId(0x13, 0x80);
+	large.fillData(0x33, 1024);
+	large.updateChecksum();
+
+	copy = large.clone();
+	stats = pool.getStats();
+	if (!copy || copy->getPayloadLen() != 1024 || stats.inUse[4] != 1 || stats.oversize - before.oversize != 1) {
+		printf("large clone mismatch\n");
+		return 1;
+	}
+	UbloxCommandBase::deleteClone(copy);
+
+	// Anything larger comes from the heap
+	UbloxCommand<1100> tooLarge;
+	tooLarge.setClassId(0x13, 0x80);
+	tooLarge.fillData(0x33, 1100);
+	tooLarge.updateChecksum();
+
+	copy = tooLarge.clone();
+	if (!copy || copy->getPayloadLen() != 1100 || pool.release(copy) || pool.getStats().oversize - before.oversize != 2) {
+		printf("heap clone mismatch\n");
+		return 1;
+	}
+	UbloxCommandBase::deleteClone(copy);
+
+	printf("test14 completed\n");
+	return 0;
+}
+
+int test15() {
+	printf("test15 started\n");
+
+	// UbloxHandlerIndex buckets
+	UbloxHandlerIndex index;
+	UbloxMessageHandler navPvt, navAny, anyPvt, ack1, ack2, ackOther;
+
+	navPvt.classFilter = 0x01;
+	navPvt.idFilter = 0x07;
+	navAny.classFilter = 0x01;
+	navAny.idFilter = 0xff;
+	anyPvt.classFilter = 0xff;
+	anyPvt.idFilter = 0x07;
+
+	ack1.classFilter = ack2.classFilter = ackOther.classFilter = UbloxCommandBase::CLASS_UBX_ACK;
+	ack1.idFilter = ack2.idFilter = ackOther.idFilter = 0xff;
+	ack1.origClassId = ack2.origClassId = ackOther.origClassId = 0x06;
+	ack1.origMsgId = ack2.origMsgId = 0x08;
+	ackOther.origMsgId = 0x01;
+
+	UbloxCommand<4> pvt, sat, ack;
+	pvt.setClassId(0x01, 0x07);
+	sat.setClassId(0x01, 0x35);
+	ack.setClassId(UbloxCommandBase::CLASS_UBX_ACK, UbloxCommandBase::MSG_UBX_ACK_ACK);
+	ack.appendU1(0x06);
+	ack.appendU1(0x08);
+
+	std::vector<UbloxMessageHandler*> matches;
+
+	if (index.hasMatch(&pvt) || index.hasMatch(&ack)) {
+		printf("empty index matched\n");
+		return 1;
+	}
+
+	index.add(&navPvt);
+	index.add(&navAny);
+	index.add(&anyPvt);
+	index.add(&ack1);
+	index.add(&ack2);
+	index.add(&ackOther);
+
+	index.findMatches(&pvt, matches);
+	if (matches.size() != 3 || matches[0] != &navPvt || matches[1] != &navAny || matches[2] != &anyPvt) {
+		printf("pvt matches mismatch size=%lu\n", matches.size());
+		return 1;
+	}
+
+	matches.clear();
+	index.findMatches(&sat, matches);
+	if (matches.size() != 1 || matches[0] != &navAny) {
+		printf("sat matches mismatch size=%lu\n", matches.size());
+		return 1;
+	}
+
+	// Only the oldest handler waiting for the ACK of CFG-RATE matches
+	matches.clear();
+	index.findMatches(&ack, matches);
+	if (matches.size() != 1 || matches[0] != &ack1) {
+		printf("ack matches mismatch size=%lu\n", matches.size());
+		return 1;
+	}
+
+	if (!index.remove(&ack1) || index.remove(&ack1)) {
+		printf("ack remove mismatch\n");
+		return 1;
+	}
+	matches.clear();
+	index.findMatches(&ack, matches);
+	if (matches.size() != 1 || matches[0] != &ack2) {
+		printf("second ack mismatch\n");
+		return 1;
+	}
+
+	// Removing the last handler for a key leaves nothing that matches
+	index.remove(&ack2);
+	index.remove(&navPvt);
+	index.remove(&navAny);
+	index.remove(&anyPvt);
+	if (index.hasMatch(&ack) || index.hasMatch(&pvt) || index.hasMatch(&sat)) {
+		printf("removed handlers still match\n");
+		return 1;
+	}
+	matches.clear();
+	index.findMatches(&pvt, matches);
+	index.findMatches(&ack, matches);
+	if (!matches.empty()) {
+		printf("removed handlers still found\n");
+		return 1;
+	}
+
+	printf("test15 completed\n");
+	return 0;
+}
+
+int test16() {
+	printf("test16 started\n");
+
+	// UbloxHandlerTimers deadline ordering and cancellation
+	UbloxHandlerTimers timers;
+	UbloxMessageHandler h1, h2, h3, h4, none;
+
+	h1.timeout = 1300;
+	h2.timeout = 1100;
+	h3.timeout = 1200;
+	h4.timeout = 1100;
+	none.timeout = 0;
+
+	timers.add(&h1);
+	timers.add(&h2);
+	timers.add(&h3);
+	timers.add(&h4);
+	timers.add(&none);
+
+	if (timers.popExpired(1000) != NULL || timers.popExpired(1100) != NULL) {
+		printf("timer expired early\n");
+		return 1;
+	}
+
+	UbloxMessageHandler *first = timers.popExpired(1101);
+	UbloxMessageHandler *second = timers.popExpired(1101);
+	if (!((first == &h2 && second == &h4) || (first == &h4 && second == &h2)) || timers.popExpired(1101) != NULL) {
+		printf("first timers mismatch\n");
+		return 1;
+	}
+
+	// A cancelled timeout is never returned
+	timers.remove(&h3);
+	if (timers.popExpired(2000) != &h1 || timers.popExpired(2000) != NULL) {
+		printf("cancelled timer mismatch\n");
+		return 1;
+	}
+
+	// A handler can be added again after its timeout was returned
+	h1.timeout = 2500;
+	timers.add(&h1);
+	if (timers.popExpired(2400) != NULL || timers.popExpired(2501) != &h1) {
+		printf("re-added timer mismatch\n");
+		return 1;
+	}
+
+	// Deadlines are compared as a signed difference
+	if (!UbloxHandlerTimers::isExpired(0xfffffffffffffff0ULL, 0x10) || UbloxHandlerTimers::isExpired(0x10, 0xfffffffffffffff0ULL)) {
+		printf("isExpired wrap mismatch\n");
+		return 1;
+	}
+
+	printf("test16 completed\n");
+	return 0;
+}
+
+int test17() {
+	printf("test17 started\n");
+
+	// UbloxMessageQueue FIFO order, full queue and index wrap. The queue only stores the
+	// pointers, so these are never dereferenced.
+	UbloxMessageQueue queue;
+	UbloxCommandBase *msgs = (UbloxCommandBase *) 0x1000;
+
+	if (queue.pop() != NULL) {
+		printf("empty queue returned a message\n");
+		return 1;
+	}
+
+	for(size_t ii = 0; ii < UbloxMessageQueue::CAPACITY; ii++) {
+		if (!queue.push(msgs + ii)) {
+			printf("push failed ii=%lu\n", ii);
+			return 1;
+		}
+	}
+	if (queue.push(msgs + UbloxMessageQueue::CAPACITY)) {
+		printf("push to a full queue succeeded\n");
+		return 1;
+	}
+	for(size_t ii = 0; ii < UbloxMessageQueue::CAPACITY; ii++) {
+		if (queue.pop() != msgs + ii) {
+			printf("pop order mismatch ii=%lu\n", ii);
+			return 1;
+		}
+	}
+	if (queue.pop() != NULL) {
+		printf("drained queue returned a message\n");
+		return 1;
+	}
+
+	// Keep a few messages in the queue while the indexes go around many times
+	size_t pushed = 0, popped = 0;
+	for(size_t ii = 0; ii < 5; ii++) {
+		queue.push(msgs + (pushed++ % 100));
+	}
+	for(size_t ii = 0; ii < 10 * UbloxMessageQueue::CAPACITY; ii++) {
+		queue.push(msgs + (pushed++ % 100));
+		if (queue.pop() != msgs + (popped++ % 100)) {
+			printf("wrap order mismatch ii=%lu\n", ii);
+			return 1;
+		}
+	}
+	while(UbloxCommandBase *cmd = queue.pop()) {
+		if (cmd != msgs + (popped++ % 100)) {
+			printf("final order mismatch\n");
+			return 1;
+		}
+	}
+	if (pushed != popped) {
+		printf("lost messages pushed=%lu popped=%lu\n", pushed, popped);
+		return 1;
+	}
+
+	UbloxMessageQueueStats stats = queue.getStats();
+	if (stats.pushed != UbloxMessageQueue::CAPACITY + pushed || stats.dropped != 1 || stats.highWater != UbloxMessageQueue::CAPACITY) {
+		printf("queue stats mismatch pushed=%u dropped=%u highWater=%u\n", stats.pushed, stats.dropped, stats.highWater);
+		return 1;
+	}
+
+	printf("test17 completed\n");
+	return 0;
+}
+
+int test18() {
+	printf("test18 started\n");
+
+	// Ublox handler registration and removal
+	Ublox ublox;
+	int calls1 = 0, calls2 = 0, immediateCalls = 0;
+
+	UbloxCommand<4> pvt;
+	pvt.setClassId(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_PVT);
+	pvt.updateChecksum();
+
+	UbloxMessageHandler handler1;
+	handler1.classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	handler1.idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+	handler1.handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		calls1++;
+	};
+
+	UbloxMessageHandler *handler2 = new UbloxMessageHandler();
+	handler2->classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	handler2->idFilter = 0xff;
+	handler2->removeAndDelete = true;
+	handler2->handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		calls2++;
+	};
+
+	UbloxMessageHandler immediate;
+	immediate.classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	immediate.idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+	immediate.immediate = true;
+	immediate.handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		immediateCalls++;
+	};
+
+	UbloxHandlerToken token1 = ublox.addHandler(&handler1);
+	ublox.addHandler(handler2);
+	UbloxHandlerToken immediateToken = ublox.addHandler(&immediate);
+	if (token1 == 0 || immediateToken == 0 || token1 == immediateToken) {
+		printf("bad tokens\n");
+		return 1;
+	}
+
+	// Handlers are added by loop, before the messages waiting for it are dispatched
+	ublox.callImmediateHandlers(&pvt);
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	if (calls1 != 1 || calls2 != 1 || immediateCalls != 0) {
+		printf("first dispatch mismatch calls1=%d calls2=%d immediate=%d\n", calls1, calls2, immediateCalls);
+		return 1;
+	}
+
+	// handler2 was removed and deleted after it was called once
+	ublox.callImmediateHandlers(&pvt);
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	if (calls1 != 2 || calls2 != 1 || immediateCalls != 1 || !ublox.hasHandler(&pvt)) {
+		printf("second dispatch mismatch calls1=%d calls2=%d immediate=%d\n", calls1, calls2, immediateCalls);
+		return 1;
+	}
+
+	// Removal takes effect on the next loop, and removing twice is harmless
+	if (!ublox.removeHandler(token1) || !ublox.removeHandler(token1) || !ublox.removeHandler(immediateToken) || ublox.removeHandler(0)) {
+		printf("removeHandler failed\n");
+		return 1;
+	}
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	ublox.callImmediateHandlers(&pvt);
+	if (calls1 != 2 || immediateCalls != 1 || ublox.hasHandler(&pvt)) {
+		printf("removed handler called calls1=%d immediate=%d\n", calls1, immediateCalls);
+		return 1;
+	}
+
+	// A handler on the stack can be added and removed in one function if loop runs before it returns
+	{
+		int stackCalls = 0;
+		UbloxMessageHandler stackHandler;
+		stackHandler.classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+		stackHandler.idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+		stackHandler.handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+			stackCalls++;
+		};
+		UbloxHandlerToken token = ublox.addHandler(&stackHandler);
+		ublox.addCommandToHandle(pvt.clone());
+		ublox.loop();
+		ublox.removeHandler(token);
+		ublox.loop();
+		if (stackCalls != 1) {
+			printf("stack handler mismatch calls=%d\n", stackCalls);
+			return 1;
+		}
+	}
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+
+	printf("test18 completed\n");
+	return 0;
+}
+
+int test19() {
+	printf("test19 started\n");
+
+	// Ublox::configTransaction matches ACKs to the commands that were sent
+	Ublox ublox;
+
+	UbloxCommand<6> rate;
+	rate.setClassId(UbloxCommandBase::CLASS_UBX_CFG, 0x08); // CFG-RATE
+	rate.appendU2(200);
+	rate.appendU2(1);
+	rate.appendU2(1);
+
+	UbloxCommand<3> msg1, msg2;
+	msg1.setClassId(UbloxCommandBase::CLASS_UBX_CFG, UbloxCommandBase::MSG_UBX_CFG_MSG);
+	msg1.appendU1(0x01);
+	msg1.appendU1(0x07);
+	msg1.appendU1(1);
+	msg2.setClassId(UbloxCommandBase::CLASS_UBX_CFG, UbloxCommandBase::MSG_UBX_CFG_MSG);
+	msg2.appendU1(0x01);
+	msg2.appendU1(0x35);
+	msg2.appendU1(1);
+
+	UbloxCommandBase *cmds[3] = { &rate, &msg1, &msg2 };
+
+	auto ackFor = [](UbloxCommandBase &cmd, bool ack) {
+		UbloxCommand<2> resp;
+		resp.setClassId(UbloxCommandBase::CLASS_UBX_ACK, ack ? UbloxCommandBase::MSG_UBX_ACK_ACK : UbloxCommandBase::MSG_UBX_ACK_NACK);
+		resp.appendU1(cmd.getMsgClass());
+		resp.appendU1(cmd.getMsgId());
+		resp.updateChecksum();
+		return resp.clone();
+	};
+
+	int callbackCount = 0;
+	std::vector<UbloxMessageHandler::Reason> results;
+	ublox.configTransaction(cmds, 3, [&](const std::vector<UbloxMessageHandler::Reason> &r) {
+		callbackCount++;
+		results = r;
+	}, 5000);
+
+	// The ACK handlers have not been added by loop yet, but ACKs must still be kept
+	UbloxCommandBase *ackRate = ackFor(rate, true);
+	UbloxCommand<4> pvt;
+	pvt.setClassId(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_PVT);
+	if (!ublox.hasHandler(ackRate) || ublox.hasHandler(&pvt)) {
+		printf("pending hasHandler mismatch\n");
+		return 1;
+	}
+
+	// ACKs arrive out of order relative to the commands with a different ID
+	ublox.addCommandToHandle(ackFor(msg1, false));
+	ublox.addCommandToHandle(ackRate);
+	ublox.loop();
+	if (callbackCount != 0) {
+		printf("transaction completed early\n");
+		return 1;
+	}
+
+	ublox.addCommandToHandle(ackFor(msg2, true));
+	ublox.loop();
+
+	if (callbackCount != 1 || results.size() != 3 || results[0] != UbloxMessageHandler::Reason::ACK ||
+		results[1] != UbloxMessageHandler::Reason::NACK || results[2] != UbloxMessageHandler::Reason::ACK) {
+		printf("transaction results mismatch count=%d size=%lu\n", callbackCount, results.size());
+		return 1;
+	}
+
+	// All of the ACK handlers are gone
+	UbloxCommandBase *extra = ackFor(msg1, true);
+	if (ublox.hasHandler(extra)) {
+		printf("ACK handlers not removed\n");
+		return 1;
+	}
+	UbloxCommandBase::deleteClone(extra);
+
+	// Commands that are not ACKed time out
+	callbackCount = 0;
+	ublox.configTransaction(cmds, 2, [&](const std::vector<UbloxMessageHandler::Reason> &r) {
+		callbackCount++;
+		results = r;
+	}, 10);
+	ublox.addCommandToHandle(ackFor(rate, true));
+	ublox.loop();
+	delay(20);
+	ublox.loop();
+	if (callbackCount != 1 || results.size() != 2 || results[0] != UbloxMessageHandler::Reason::ACK ||
+		results[1] != UbloxMessageHandler::Reason::TIMEOUT) {
+		printf("transaction timeout mismatch count=%d\n", callbackCount);
+		return 1;
+	}
+
+	printf("test19 completed\n");
+	return 0;
+}
+
+int test20() {
+	printf("test20 started\n");
+
+	// Ublox handlers that run callHandlers again, as a *Sync call from a handler does
+	Ublox ublox;
+
+	if (ublox.isHandlerThread()) {
+		printf("isHandlerThread before setup\n");
+		return 1;
+	}
+
+	UbloxCommand<4> pvt;
+	pvt.setClassId(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_PVT);
+	pvt.updateChecksum();
+
+	// A removeAndDelete handler that removes itself is only deleted once
+	int selfCalls = 0;
+	UbloxHandlerToken selfToken = 0;
+	UbloxMessageHandler *selfHandler = new UbloxMessageHandler();
+	selfHandler->classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	selfHandler->idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+	selfHandler->removeAndDelete = true;
+	selfHandler->timeout = System.millis() + 60000;
+	selfHandler->handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		selfCalls++;
+		ublox.removeHandler(selfToken);
+		ublox.callHandlers();
+	};
+	selfToken = ublox.addHandler(selfHandler);
+
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	if (selfCalls != 1 || ublox.hasHandler(&pvt)) {
+		printf("self removal mismatch calls=%d\n", selfCalls);
+		return 1;
+	}
+
+	// A timeout that expires while the handler is running is delivered after it returns
+	int dataCalls = 0, timeoutCalls = 0;
+	UbloxMessageHandler slowHandler;
+	slowHandler.classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	slowHandler.idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+	slowHandler.timeout = System.millis() + 5;
+	slowHandler.handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		if (reason == UbloxMessageHandler::Reason::TIMEOUT) {
+			timeoutCalls++;
+			return;
+		}
+		dataCalls++;
+		delay(10);
+		ublox.callHandlers();
+	};
+	UbloxHandlerToken slowToken = ublox.addHandler(&slowHandler);
+
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	delay(2);
+	ublox.loop();
+	if (dataCalls != 1 || timeoutCalls != 1) {
+		printf("slow handler timeout lost data=%d timeout=%d\n", dataCalls, timeoutCalls);
+		return 1;
+	}
+	ublox.removeHandler(slowToken);
+	ublox.loop();
+
+	printf("test20 completed\n");
+	return 0;
+}
+
+int test21() {
+	printf("test21 started\n");
+
+	// The decoding thread reads a published copy of the handler indexes
+	Ublox ublox;
+
+	UbloxCommand<4> pvt, sat;
+	pvt.setClassId(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_PVT);
+	pvt.updateChecksum();
+	sat.setClassId(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_SAT);
+	sat.updateChecksum();
+
+	// Nothing is published until the first handler is added
+	ublox.callImmediateHandlers(&pvt);
+	if (ublox.hasHandler(&pvt)) {
+		printf("empty hasHandler mismatch\n");
+		return 1;
+	}
+
+	UbloxMessageHandler satHandler;
+	satHandler.classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	satHandler.idFilter = UbloxCommandBase::MSG_UBX_NAV_SAT;
+	satHandler.handler = [](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+	};
+	UbloxHandlerToken satToken = ublox.addHandler(&satHandler);
+
+	// Adding and removing over and over publishes a new snapshot each time and reuses the old ones
+	int immediateCalls = 0;
+	for(int ii = 0; ii < 20; ii++) {
+		UbloxMessageHandler immediate;
+		immediate.classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+		immediate.idFilter = 0xff;
+		immediate.immediate = true;
+		immediate.handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+			immediateCalls++;
+		};
+		UbloxHandlerToken token = ublox.addHandler(&immediate);
+
+		ublox.callImmediateHandlers(&pvt);
+		ublox.loop();
+		ublox.callImmediateHandlers(&pvt);
+		ublox.callImmediateHandlers(&sat);
+
+		if (!ublox.hasHandler(&sat) || ublox.hasHandler(&pvt)) {
+			printf("hasHandler mismatch ii=%d\n", ii);
+			return 1;
+		}
+
+		ublox.removeHandler(token);
+		ublox.loop();
+		ublox.callImmediateHandlers(&pvt);
+	}
+	if (immediateCalls != 40) {
+		printf("immediate calls mismatch %d\n", immediateCalls);
+		return 1;
+	}
+
+	ublox.removeHandler(satToken);
+	ublox.loop();
+	if (ublox.hasHandler(&sat)) {
+		printf("removed handler still published\n");
+		return 1;
+	}
+
+	printf("test21 completed\n");
+	return 0;
+}
+
+int test22() {
+	printf("test22 started\n");
+
+	// removeHandler can't run out of room, however many removals are waiting for loop
+	Ublox ublox;
+
+	UbloxCommand<4> pvt;
+	pvt.setClassId(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_PVT);
+	pvt.updateChecksum();
+
+	const int NUM_HANDLERS = 40;
+	int calls = 0;
+	UbloxMessageHandler handlers[NUM_HANDLERS];
+	UbloxHandlerToken tokens[NUM_HANDLERS];
+	for(int ii = 0; ii < NUM_HANDLERS; ii++) {
+		handlers[ii].classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+		handlers[ii].idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+		handlers[ii].handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+			calls++;
+		};
+		tokens[ii] = ublox.addHandler(&handlers[ii]);
+	}
+
+	int deletedCalls = 0;
+	UbloxHandlerToken deleteTokens[NUM_HANDLERS];
+	for(int ii = 0; ii < NUM_HANDLERS; ii++) {
+		UbloxMessageHandler *handler = new UbloxMessageHandler();
+		handler->classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+		handler->idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+		handler->removeAndDelete = true;
+		handler->timeout = System.millis() + 60000;
+		handler->handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+			deletedCalls++;
+		};
+		deleteTokens[ii] = ublox.addHandler(handler);
+	}
+
+	// Half of each are removed before loop has added them
+	for(int ii = 0; ii < NUM_HANDLERS / 2; ii++) {
+		if (!ublox.removeHandler(tokens[ii]) || !ublox.removeHandler(deleteTokens[ii])) {
+			printf("pending removeHandler failed ii=%d\n", ii);
+			return 1;
+		}
+	}
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	if (calls != NUM_HANDLERS / 2 || deletedCalls != NUM_HANDLERS / 2) {
+		printf("pending removal mismatch calls=%d deletedCalls=%d\n", calls, deletedCalls);
+		return 1;
+	}
+
+	// The removeAndDelete handlers that were called are gone, the rest are removed in one burst
+	for(int ii = 0; ii < NUM_HANDLERS; ii++) {
+		if (ublox.removeHandler(deleteTokens[ii])) {
+			printf("deleted handler found ii=%d\n", ii);
+			return 1;
+		}
+	}
+	for(int ii = NUM_HANDLERS / 2; ii < NUM_HANDLERS; ii++) {
+		if (!ublox.removeHandler(tokens[ii])) {
+			printf("removeHandler failed ii=%d\n", ii);
+			return 1;
+		}
+	}
+
+	// None of the removed handlers are called again
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	if (calls != NUM_HANDLERS / 2 || ublox.hasHandler(&pvt)) {
+		printf("removed handler called calls=%d\n", calls);
+		return 1;
+	}
+	for(int ii = 0; ii < NUM_HANDLERS; ii++) {
+		if (ublox.removeHandler(tokens[ii])) {
+			printf("removed handler found ii=%d\n", ii);
+			return 1;
+		}
+	}
+
+	// Once removed, a handler can be added again
+	UbloxHandlerToken token = ublox.addHandler(&handlers[0]);
+	ublox.addCommandToHandle(pvt.clone());
+	ublox.loop();
+	if (calls != NUM_HANDLERS / 2 + 1 || !ublox.removeHandler(token)) {
+		printf("re-added handler mismatch calls=%d\n", calls);
+		return 1;
+	}
+	ublox.loop();
+
+	printf("test22 completed\n");
+	return 0;
+}
+
+int test23() {
+	printf("test23 started\n");
+
+	// An immediate handler can remove handlers, but a *Sync method can't wait for its response
+	Ublox ublox;
+
+	UbloxCommand<4> pvt;
+	pvt.setClassId(UbloxCommandBase::CLASS_UBX_NAV, UbloxCommandBase::MSG_UBX_NAV_PVT);
+	pvt.updateChecksum();
+
+	UbloxCommand<3> cfgMsg;
+	cfgMsg.setClassId(UbloxCommandBase::CLASS_UBX_CFG, UbloxCommandBase::MSG_UBX_CFG_MSG);
+	cfgMsg.setU1(0, UbloxCommandBase::CLASS_UBX_NAV);
+	cfgMsg.setU1(1, UbloxCommandBase::MSG_UBX_NAV_PVT);
+	cfgMsg.setU1(2, 1);
+
+	UbloxMessageHandler other;
+	other.classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	other.idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+	other.immediate = true;
+	other.handler = [](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+	};
+	UbloxHandlerToken otherToken = ublox.addHandler(&other);
+
+	int immediateCalls = 0;
+	bool inImmediate = false;
+	bool syncResult = true;
+	unsigned long syncMs = 0;
+	UbloxHandlerToken token = 0;
+	UbloxMessageHandler immediate;
+	immediate.classFilter = UbloxCommandBase::CLASS_UBX_NAV;
+	immediate.idFilter = UbloxCommandBase::MSG_UBX_NAV_PVT;
+	immediate.immediate = true;
+	immediate.handler = [&](UbloxCommandBase *cmd, UbloxMessageHandler::Reason reason) {
+		immediateCalls++;
+		inImmediate = ublox.isImmediateHandlerThread();
+
+		unsigned long start = millis();
+		syncResult = ublox.configCommandSync(&cfgMsg, 2000);
+		syncMs = millis() - start;
+
+		ublox.removeHandler(otherToken);
+		ublox.removeHandler(token);
+	};
+	token = ublox.addHandler(&immediate);
+	ublox.loop();
+
+	ublox.callImmediateHandlers(&pvt);
+	if (immediateCalls != 1 || !inImmediate || syncResult || syncMs >= 2000) {
+		printf("sync from immediate handler mismatch calls=%d result=%d ms=%lu\n", immediateCalls, (int) syncResult, syncMs);
+		return 1;
+	}
+	if (ublox.isImmediateHandlerThread()) {
+		printf("immediate thread not cleared\n");
+		return 1;
+	}
+
+	// Both removals take effect on the next loop, which does not wait for a handler that has returned
+	ublox.callImmediateHandlers(&pvt);
+	ublox.loop();
+	ublox.callImmediateHandlers(&pvt);
+	if (immediateCalls != 1 || ublox.removeHandler(token) || ublox.removeHandler(otherToken)) {
+		printf("removed immediate handler mismatch calls=%d\n", immediateCalls);
+		return 1;
+	}
+
+	printf("test23 completed\n");
+	return 0;
+}
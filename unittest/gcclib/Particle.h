@@ -19,6 +19,8 @@ public:
 
 	virtual int available();
 	virtual int read();
+
+	size_t readBytes(char *buffer, size_t length);
 };
 
 class USARTSerial : public Stream {
@@ -33,6 +35,7 @@ public:
 
 system_tick_t millis();
 void delay(uint32_t ms);
+int os_thread_yield(void);
 
 // Arduino compatibility
 typedef bool boolean;
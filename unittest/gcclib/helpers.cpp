@@ -1,6 +1,7 @@
 #include "Particle.h"
 
 #include <sys/time.h>
+#include <sched.h>
 
 extern "C"
 char *itoa ( int value, char * str, int base ) {
@@ -108,6 +109,9 @@ void delay(uint32_t ms) {
 	}
 }
 
+int os_thread_yield(void) {
+	return sched_yield();
+}
 
 Stream::~Stream() {
 }
@@ -118,6 +122,17 @@ int Stream::available() {
 int Stream::read() {
 	return -1;
 }
+size_t Stream::readBytes(char *buffer, size_t length) {
+	size_t count = 0;
+	while(count < length) {
+		int c = read();
+		if (c < 0) {
+			break;
+		}
+		buffer[count++] = (char)c;
+	}
+	return count;
+}
 
 USARTSerial::~USARTSerial() {
 }